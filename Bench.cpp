@@ -0,0 +1,339 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <regex>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <format>
+#include "Bench.h"
+#include "ThreeN1.h"
+#include "BigIntBench.h"
+
+// stream buffer that drops everything, used to silence kernels that print progress
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+};
+
+Bench::Bench(uint64_t scale): m_scale(scale == 0 ? SCALE_DEF : scale)
+{
+}
+
+template<typename IntImpl>
+BenchResult Bench::runKernel(const char* kernel, const std::string& rangeName, const IntImpl& start, uint64_t count, uint64_t threadsCnt)
+{
+    // process peak only grows, so it is reset to measure memory of this kernel only (including cache and steps table).
+    // where it can't be reset, RSS at the end of the kernel is reported instead
+    bool peakReset = ResetPeakRss();
+
+    using Calc = ThreeN1<IntImpl>;
+    Calc calc;
+    IntImpl finish = start;
+    finish += count;
+
+    BenchResult res;
+    res.kernel = kernel;
+    res.type = std::is_same<IntImpl, BigInt>::value ? "BigInt" : "uint64_t";
+    res.range = rangeName;
+
+    std::string k = kernel;
+    if (threadsCnt == 0) threadsCnt = std::max<uint64_t>(1, std::thread::hardware_concurrency());
+
+    if (k == "calc3p1Cache") // cache of numbers 1..CACHE_SIZE is filled before measurement
+    {
+        ThreeN1<uint64_t> calc64;
+        ThreeN1<uint64_t>::CalcDataType data64;
+        calc.m_valuesCache.Clear();
+        calc.m_valuesCache.SetCapacity(CACHE_SIZE);
+        for (uint64_t i = 1; i <= CACHE_SIZE; i++)
+        {
+            calc64.Calc3p1(i, data64);
+            typename Calc::CalcDataType data;
+            data.steps = data64.steps;
+            data.maxvalue = data64.maxvalue;
+            calc.m_valuesCache.AddValue(data);
+        }
+        calc.m_cacheStart = 1ull;
+        calc.m_cacheFinish = CACHE_SIZE + 1ull;
+    }
+    else if (k == "Calc3p1Steps")
+    {
+        calc.SetStepsTable(StepsTable::SIZE_DEF);
+    }
+    else if (k == "threads" || k == "threadsFast")
+    {
+        calc.SetRecordsOnly(k == "threadsFast");
+        calc.SetTaskRange(std::max<uint64_t>(1000, count / (threadsCnt * 8))); // enough sub-ranges for all threads
+    }
+
+    auto runOnce = [&](BenchResult& r)
+    {
+        r.numbers = r.steps = r.errors = 0;
+        typename Calc::CalcDataType data;
+
+        if (k == "threads" || k == "threadsFast")
+        {
+            NullBuffer nullBuf;
+            std::streambuf* coutBuf = std::cout.rdbuf(&nullBuf); // threaded calculation prints progress and records
+            try
+            {
+                calc.Calc3p1allThreads(start, finish, threadsCnt);
+            }
+            catch (...)
+            {
+                std::cout.rdbuf(coutBuf);
+                throw;
+            }
+            std::cout.rdbuf(coutBuf);
+
+            for (auto& ctx : calc.m_contexts)
+            {
+                if (!ctx) continue;
+                r.numbers += ctx->progress.load(); // includes numbers of sub-ranges stopped by overflow
+                r.steps += ctx->steps;
+            }
+            r.errors = count - r.numbers; // numbers skipped after overflow in their sub-ranges
+            return;
+        }
+
+        uint64_t allocs0 = ThreadAllocations();
+        IntImpl i = start;
+        for (uint64_t n = 0; n < count; n++, ++i)
+        {
+            try
+            {
+                if (k == "Calc3p1")
+                    calc.Calc3p1(i, data);
+                else if (k == "Calc3p1Fast")
+                    calc.Calc3p1Fast(i, data);
+                else if (k == "Calc3p1Steps")
+                    data.steps = calc.Calc3p1Steps(i);
+                else
+                    calc.calc3p1Cache(start, finish, i, data);
+
+                r.numbers++;
+                r.steps += data.steps;
+            }
+            catch (std::overflow_error&)
+            {
+                r.errors++;
+            }
+        }
+        if (ALLOCATIONS_COUNTED) r.allocsPerNum = (double)(ThreadAllocations() - allocs0) / count;
+    };
+
+    for (uint64_t rep = 0; rep <= REPEATS; rep++) // first run is warm-up
+    {
+        BenchResult r = res;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        runOnce(r);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        r.seconds = std::chrono::duration<double>(t1 - t0).count();
+
+        if (rep == 1 || (rep > 1 && r.seconds < res.seconds))
+            res = r;
+    }
+
+    res.peakRss = peakReset ? PeakRss() : CurrentRss();
+    return res;
+}
+
+template<typename IntImpl>
+void Bench::runType(const char* typeName, uint64_t divider)
+{
+    struct StdRange
+    {
+        const char* name;
+        IntImpl start;
+        uint64_t count;
+    };
+
+    std::vector<StdRange> ranges = {
+        { "1..10M",        1ull,        10'000'000ull },
+        { "2^40..2^40+10M", 1ull << 40, 10'000'000ull },
+        { "2^60..2^60+1M",  1ull << 60,  1'000'000ull },
+    };
+    if constexpr (std::is_same<IntImpl, BigInt>::value) // trajectories are not demoted to uint64_t, but fit into BigIntDigits::INLINE_SIZE digits
+        ranges.push_back({ "2^80..2^80+10M", BigInt("1208925819614629174706176"), 10'000'000ull });
+
+    const char* kernels[] = { "Calc3p1", "Calc3p1Fast", "Calc3p1Steps", "calc3p1Cache", "threads", "threadsFast" };
+
+    std::cout << "Type: " << typeName << std::endl;
+    for (const char* kernel : kernels)
+    {
+        for (const StdRange& r : ranges)
+        {
+            uint64_t count = std::max<uint64_t>(1, r.count * m_scale / 100 / divider);
+            m_results.push_back(runKernel<IntImpl>(kernel, r.name, r.start, count));
+            print(m_results.back());
+        }
+    }
+}
+
+template<typename IntImpl>
+void Bench::runScaling(const char* typeName, const std::string& rangeName, const IntImpl& start, uint64_t count, uint64_t maxThreads)
+{
+    std::cout << "Type: " << typeName << ", range: " << rangeName << std::endl;
+    std::cout << std::format("{:>7} {:>14} {:>9} {:>11}", "Threads", "num/sec", "Speedup", "Efficiency") << std::endl;
+
+    double base = 0;
+    for (uint64_t threads = 1; ; threads = std::min(threads * 2, maxThreads))
+    {
+        BenchResult r = runKernel<IntImpl>("threads", rangeName, start, count, threads);
+        if (threads == 1) base = r.NumPerSec();
+        double speedup = base > 0 ? r.NumPerSec() / base : 0;
+        std::cout << std::format("{:>7} {:>14.0f} {:>8.2f}x {:>10.1f}%", threads, r.NumPerSec(), speedup, speedup * 100 / threads) << std::endl;
+        if (threads == maxThreads) break;
+    }
+}
+
+void Bench::RunScaling(uint64_t maxThreads)
+{
+    if (maxThreads == 0) maxThreads = std::max<uint64_t>(1, std::thread::hardware_concurrency());
+    std::cout << "Scaling benchmark. Threads: 1.." << maxThreads << ", ranges scale: " << m_scale << "%, hardware threads: "
+        << std::thread::hardware_concurrency() << std::endl;
+
+    runScaling<uint64_t>("uint64_t", "1..10M", 1ull, std::max<uint64_t>(1, 10'000'000ull * m_scale / 100), maxThreads);
+    runScaling<BigInt>("BigInt", "10^40..10^40+100K", BigInt("10000000000000000000000000000000000000000"),
+        std::max<uint64_t>(1, 100'000ull * m_scale / 100), maxThreads);
+}
+
+void Bench::print(const BenchResult& r)
+{
+    std::cout << std::format("{:<13} {:<9} {:<16} {:>12.0f} num/sec {:>14.0f} steps/sec {:>8.2f} ns/step  peak RSS: {} MB",
+        r.kernel, r.type, r.range, r.NumPerSec(), r.StepsPerSec(), r.NsPerStep(), r.peakRss >> 20);
+    if (r.allocsPerNum >= 0) std::cout << std::format("  allocs/num: {:.3f}", r.allocsPerNum);
+    if (r.errors > 0) std::cout << "  overflows: " << r.errors;
+    std::cout << std::endl;
+}
+
+// one result per line, so baseline can be read back without JSON library
+void Bench::saveBaseline(const std::string& fileName)
+{
+    std::ofstream f(fileName, std::ios::out | std::ios::trunc);
+    if (f.fail())
+        throw std::invalid_argument("Error: cannot open file '" + fileName + "'\n");
+
+    f << "{\n  \"scale\": " << m_scale << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        const BenchResult& r = m_results[i];
+        f << std::format("    {{\"kernel\": \"{}\", \"type\": \"{}\", \"range\": \"{}\", \"numbers\": {}, \"steps\": {}, \"errors\": {}, "
+            "\"seconds\": {:.6f}, \"num_per_sec\": {:.1f}, \"steps_per_sec\": {:.1f}, \"ns_per_step\": {:.4f}, \"peak_rss\": {}, \"allocs_per_num\": {:.4f}}}",
+            r.kernel, r.type, r.range, r.numbers, r.steps, r.errors, r.seconds, r.NumPerSec(), r.StepsPerSec(), r.NsPerStep(), r.peakRss, r.allocsPerNum);
+        f << (i + 1 < m_results.size() ? ",\n" : "\n");
+    }
+    f << "  ]\n}\n";
+}
+
+bool Bench::loadBaseline(const std::string& fileName, std::vector<BenchResult>& baseline, uint64_t& scale)
+{
+    std::ifstream f(fileName);
+    if (f.fail()) return false;
+
+    const std::regex scaleRe("\"scale\":\\s*(\\d+)");
+    const std::regex fieldRe("\"(\\w+)\":\\s*(\"([^\"]*)\"|[-+0-9.eE]+)");
+
+    std::string line;
+    std::smatch m;
+    while (std::getline(f, line))
+    {
+        if (std::regex_search(line, m, scaleRe))
+        {
+            scale = std::stoull(m[1]);
+            continue;
+        }
+
+        if (line.find("\"kernel\"") == std::string::npos) continue;
+
+        BenchResult r;
+        for (auto it = std::sregex_iterator(line.begin(), line.end(), fieldRe); it != std::sregex_iterator(); ++it)
+        {
+            std::string name = (*it)[1], value = (*it)[3].matched ? (*it)[3].str() : (*it)[2].str();
+            if (name == "kernel") r.kernel = value;
+            else if (name == "type") r.type = value;
+            else if (name == "range") r.range = value;
+            else if (name == "numbers") r.numbers = std::stoull(value);
+            else if (name == "steps") r.steps = std::stoull(value);
+            else if (name == "errors") r.errors = std::stoull(value);
+            else if (name == "seconds") r.seconds = std::stod(value);
+            else if (name == "peak_rss") r.peakRss = std::stoull(value);
+            else if (name == "allocs_per_num") r.allocsPerNum = std::stod(value);
+        }
+        baseline.push_back(r);
+    }
+
+    return true;
+}
+
+int Bench::Run(const std::string& baselineFile)
+{
+    std::cout << "Benchmark. Ranges scale: " << m_scale << "%, repeats: " << REPEATS << " (+1 warm-up)" << std::endl;
+
+    m_results.clear();
+    runType<uint64_t>("uint64_t", 1);
+    runType<BigInt>("BigInt", 100);
+
+    // numbers of standard ranges and their trajectories are shorter than BigIntDigits::INLINE_SIZE digits, so no allocations are expected.
+    // overflow of uint64_t allocates its exception, kernels with errors are not checked
+    if (!ALLOCATIONS_COUNTED)
+        std::cout << "Allocations are not counted (build without USE_ALLOC_COUNTER), allocations check is skipped." << std::endl;
+    int allocFailures = 0;
+    for (const BenchResult& r : m_results)
+    {
+        if (r.errors > 0 || r.allocsPerNum <= MAX_ALLOCS_PER_NUM) continue;
+        std::cout << std::format("{:<13} {:<9} {:<16} allocs/num: {:.3f}  *** ALLOCATIONS REGRESSION ***", r.kernel, r.type, r.range, r.allocsPerNum) << std::endl;
+        allocFailures++;
+    }
+    if (allocFailures > 0)
+    {
+        std::cout << "BENCHMARK FAILED: " << allocFailures << " kernel(s) allocate memory, more than " << MAX_ALLOCS_PER_NUM << " allocations per number" << std::endl;
+        return 2;
+    }
+
+    if (baselineFile.empty()) return 0;
+
+    std::vector<BenchResult> baseline;
+    uint64_t scale = 0;
+    if (!loadBaseline(baselineFile, baseline, scale))
+    {
+        saveBaseline(baselineFile);
+        std::cout << "Baseline saved into: " << baselineFile << std::endl;
+        return 0;
+    }
+
+    if (scale != m_scale)
+    {
+        std::cout << "Baseline '" << baselineFile << "' is made with scale " << scale << "%, comparison is skipped." << std::endl;
+        return 0;
+    }
+
+    std::map<std::string, const BenchResult*> base;
+    for (const BenchResult& r : baseline)
+        base[r.kernel + "|" + r.type + "|" + r.range] = &r;
+
+    int regressions = 0;
+    std::cout << "Comparison with baseline: " << baselineFile << std::endl;
+    for (const BenchResult& r : m_results)
+    {
+        auto it = base.find(r.kernel + "|" + r.type + "|" + r.range);
+        if (it == base.end() || it->second->NumPerSec() == 0) continue;
+
+        double change = r.NumPerSec() / it->second->NumPerSec() - 1.0;
+        bool regression = change < -REGRESSION_TOLERANCE;
+        std::cout << std::format("{:<13} {:<9} {:<16} {:>+7.1f}%{}", r.kernel, r.type, r.range, change * 100, regression ? "  *** REGRESSION ***" : "") << std::endl;
+        if (regression) regressions++;
+    }
+
+    if (regressions > 0)
+    {
+        std::cout << "BENCHMARK FAILED: " << regressions << " regression(s) more than " << REGRESSION_TOLERANCE * 100 << "%" << std::endl;
+        return 2;
+    }
+
+    std::cout << "No regressions." << std::endl;
+    return 0;
+}
+
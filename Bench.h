@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// result of one kernel on one range
+struct BenchResult
+{
+	std::string kernel;   // Calc3p1, Calc3p1Fast, Calc3p1Steps, calc3p1Cache, threads, threadsFast
+	std::string type;     // uint64_t, BigInt
+	std::string range;    // name of standard range
+	uint64_t numbers = 0;
+	uint64_t steps = 0;
+	uint64_t errors = 0;  // numbers that could not be calculated (overflow of uint64_t)
+	double seconds = 0;   // best time of all repeats
+	uint64_t peakRss = 0; // peak RSS of the process during the kernel (RSS at its end if peak can't be reset, see ResetPeakRss), bytes
+	double allocsPerNum = -1; // memory allocations per number, measured for single-thread kernels only
+
+	double NumPerSec() const { return seconds > 0 ? numbers / seconds : 0; }
+	double StepsPerSec() const { return seconds > 0 ? steps / seconds : 0; }
+	double NsPerStep() const { return steps > 0 ? seconds * 1e9 / steps : 0; }
+};
+
+// Built-in benchmark, option --bench.
+// Runs each kernel (Calc3p1, Calc3p1Fast, Calc3p1Steps, calc3p1Cache, threaded, threaded record-only) for each IntImpl (uint64_t, BigInt) over standard ranges:
+// 1..10M, 2^40..2^40+10M, 2^60..2^60+1M, and 2^80..2^80+10M for BigInt. BigInt is ~500 times slower than uint64_t, so its ranges are 100 times shorter.
+// Every kernel is run once for warm-up and then REPEATS times, the best time is reported.
+// Results are compared with baseline JSON file, drop of speed more than REGRESSION_TOLERANCE fails the benchmark.
+// If baseline file does not exist, it is created from current results.
+// Single-thread kernels also report memory allocations per number (BigInt should not allocate for numbers up to BigIntDigits::INLINE_SIZE digits),
+// more than MAX_ALLOCS_PER_NUM fails the benchmark regardless of baseline. Allocations are counted only in build with USE_ALLOC_COUNTER (see ThreadAllocations).
+class Bench
+{
+private:
+	uint64_t m_scale;  // size of ranges in percents of standard ones
+	std::vector<BenchResult> m_results;
+
+	template<typename IntImpl>
+	void runType(const char* typeName, uint64_t divider);
+
+	// threadsCnt is used by threaded kernels, 0 - number of hardware threads
+	template<typename IntImpl>
+	BenchResult runKernel(const char* kernel, const std::string& rangeName, const IntImpl& start, uint64_t count, uint64_t threadsCnt = 0);
+
+	template<typename IntImpl>
+	void runScaling(const char* typeName, const std::string& rangeName, const IntImpl& start, uint64_t count, uint64_t maxThreads);
+
+	void print(const BenchResult& r);
+	void saveBaseline(const std::string& fileName);
+	bool loadBaseline(const std::string& fileName, std::vector<BenchResult>& baseline, uint64_t& scale);
+
+public:
+	static const uint64_t REPEATS = 3;
+	static const uint64_t SCALE_DEF = 100;
+	static const uint64_t CACHE_SIZE = 1'000'000; // numbers 1..CACHE_SIZE are cached for calc3p1Cache kernel
+	static constexpr double REGRESSION_TOLERANCE = 0.10;
+	static constexpr double MAX_ALLOCS_PER_NUM = 0; // for numbers up to BigIntDigits::INLINE_SIZE digits
+
+	Bench(uint64_t scale = SCALE_DEF);
+
+	// returns process exit code: 0 - ok, 2 - regression against baseline
+	int Run(const std::string& baselineFile);
+
+	// Scaling of threaded kernel (option --bench-scaling): the same range is calculated by 1, 2, 4, ... maxThreads threads,
+	// speedup and efficiency (speedup / threads) against one thread are reported.
+	// BigInt range starts at 10^40, so its numbers are longer than BigIntDigits::INLINE_SIZE and use BigIntArena.
+	void RunScaling(uint64_t maxThreads);
+};
+
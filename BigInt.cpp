@@ -1,9 +1,94 @@
 
 #include <sstream>
 #include <vector>
+#include <cstring>
+#include <climits>
+#include <string_view>
 
 #include "BigInt.h"
 
+// free lists of one thread. the struct is trivially destructible, so it remains accessible
+// while other thread_local objects (possibly BigInts) are destroyed at thread exit
+struct ArenaCache
+{
+    char* head[BigIntArena::CLASSES];
+    uint32_t count[BigIntArena::CLASSES];
+    uint64_t hits; // buffers taken from the cache
+    bool closed; // thread is finishing, freed buffers are not cached anymore
+};
+
+static thread_local ArenaCache t_arena{};
+
+// releases cached buffers at thread exit
+struct ArenaReleaser
+{
+    ~ArenaReleaser()
+    {
+        BigIntArena::Release();
+        t_arena.closed = true;
+    }
+};
+
+static thread_local ArenaReleaser t_arenaReleaser;
+
+// index of size class of a buffer, CLASSES if buffer is too big to be cached
+static uint32_t arenaClass(size_t size)
+{
+    if (size <= BigIntArena::MIN_BLOCK) return 0;
+    return std::min<uint32_t>((uint32_t)std::bit_width((size - 1) / BigIntArena::MIN_BLOCK), BigIntArena::CLASSES);
+}
+
+char* BigIntArena::Allocate(size_t& size)
+{
+    uint32_t c = arenaClass(size);
+    if (c == CLASSES)
+        return new char[size];
+
+    size = (size_t)MIN_BLOCK << c;
+    if (char* p = t_arena.head[c])
+    {
+        t_arena.head[c] = *(char**)p;
+        t_arena.count[c]--;
+        t_arena.hits++;
+        return p;
+    }
+
+    (void)&t_arenaReleaser; // registers release of the cache at exit of this thread
+    return new char[size];
+}
+
+void BigIntArena::Free(char* p, size_t size)
+{
+    uint32_t c = arenaClass(size);
+    if (c == CLASSES || t_arena.closed || t_arena.count[c] >= std::clamp<size_t>(MAX_CACHED_BYTES / size, 1, MAX_CACHED))
+    {
+        delete[] p;
+        return;
+    }
+
+    *(char**)p = t_arena.head[c];
+    t_arena.head[c] = p;
+    t_arena.count[c]++;
+}
+
+uint64_t BigIntArena::CachedAllocations()
+{
+    return t_arena.hits;
+}
+
+void BigIntArena::Release()
+{
+    for (uint32_t c = 0; c < CLASSES; c++)
+    {
+        while (char* p = t_arena.head[c])
+        {
+            t_arena.head[c] = *(char**)p;
+            delete[] p;
+        }
+        t_arena.count[c] = 0;
+    }
+}
+
 bool Null(const BigInt& a)
 {
     if (a.digits.size() == 1 && a.digits[0] == 0)
@@ -16,9 +101,41 @@ int Length(const BigInt& a)
     return (int)a.digits.size();
 }
 
+double Log2(const BigInt& a)
+{
+    const int MANTISSA_DIGITS = 17; // digits that fit into mantissa of double
+    int len = Length(a), top = std::min(len, MANTISSA_DIGITS);
+    double mantissa = 0;
+    for (int i = len - 1; i >= len - top; i--) // digits are stored from the least significant one
+        mantissa = mantissa * 10 + a.digits[i];
+    return std::log2(mantissa) + (len - top) * std::log2(10.0);
+}
+
+uint64_t IntLog2(const BigInt& a)
+{
+    if (a.fits_u64()) return IntLog2((uint64_t)a.to_u64());
+
+    // a = top * 10^e + rest, rest < 10^e, so log2(a) exceeds estimate by less than log2(1 + 1 / top) < 2e-18.
+    // estimate itself is precise to ~1e-9 for numbers of millions of digits, so it is checked exactly only near integer
+    const int TOP_DIGITS = 19; // fit into uint64_t
+    const double EPS = 1e-6;
+    int len = Length(a);
+    uint64_t top = 0;
+    for (int i = len - 1; i >= len - TOP_DIGITS; i--)
+        top = top * 10 + a.digits[i];
+    double est = std::log2((double)top) + (len - TOP_DIGITS) * std::log2(10.0);
+    double k = std::floor(est + 0.5);
+    if (std::abs(est - k) > EPS) return (uint64_t)est;
+
+    BigInt pow2(1ull);
+    for (uint64_t i = 0; i < (uint64_t)k; i += 62)
+        pow2 *= 1ull << std::min<uint64_t>(62, (uint64_t)k - i);
+    return a >= pow2 ? (uint64_t)k : (uint64_t)k - 1;
+}
+
 BigInt::BigInt(std::string& s)
 {
-    digits = "";
+    digits.clear();
     int n = (int)s.size();
     for (int i = n - 1; i >= 0; i--)
     {
@@ -39,7 +156,7 @@ BigInt::BigInt(unsigned long long nr)
 
 BigInt::BigInt(const char* s)
 {
-    digits = "";
+    digits.clear();
     for (int i = (int)strlen(s) - 1; i >= 0; i--)
     {
         if (!isdigit(s[i]))
@@ -75,9 +192,10 @@ bool operator<(const BigInt& a, const BigInt& b)
     int n = Length(a), m = Length(b);
     if (n != m)
         return n < m;
+    const char* da = a.digits.data(), * db = b.digits.data();
     while (n--)
-        if (a.digits[n] != b.digits[n])
-            return a.digits[n] < b.digits[n];
+        if (da[n] != db[n])
+            return da[n] < db[n];
     return false;
 }
 
@@ -104,20 +222,20 @@ BigInt& BigInt::operator=(const BigInt& a)
 
 BigInt& BigInt::operator++()
 {
+    char* d = digits.data();
     int i, n = (int)digits.size();
-    for (i = 0; i < n && digits[i] == 9; i++)
-        digits[i] = 0;
+    for (i = 0; i < n && d[i] == 9; i++)
+        d[i] = 0;
     if (i == n)
         digits.push_back(1);
     else
-        digits[i]++;
+        d[i]++;
     return *this;
 }
 
 BigInt BigInt::operator++(int)
 {
-    BigInt aux;
-    aux = *this;
+    BigInt aux(*this);
     ++(*this);
     return aux;
 }
@@ -137,8 +255,7 @@ BigInt& BigInt::operator--()
 
 BigInt BigInt::operator--(int)
 {
-    BigInt aux;
-    aux = *this;
+    BigInt aux(*this);
     --(*this);
     return aux;
 }
@@ -166,12 +283,17 @@ BigInt& operator+=(BigInt& a, const BigInt& b)
 
 BigInt operator+(const BigInt& a, const BigInt& b)
 {
-    BigInt temp;
-    temp = a;
+    BigInt temp(a);
     temp += b;
     return temp;
 }
 
+BigInt operator+(BigInt&& a, const BigInt& b)
+{
+    a += b;
+    return std::move(a);
+}
+
 BigInt& operator-=(BigInt& a, const BigInt& b)
 {
     if (a < b)
@@ -198,12 +320,304 @@ BigInt& operator-=(BigInt& a, const BigInt& b)
 
 BigInt operator-(const BigInt& a, const BigInt& b)
 {
-    BigInt temp;
-    temp = a;
+    BigInt temp(a);
     temp -= b;
     return temp;
 }
 
+BigInt operator-(BigInt&& a, const BigInt& b)
+{
+    a -= b;
+    return std::move(a);
+}
+
+// Long multiplication and division work with limbs of base 10^9 (9 decimal digits, least significant first).
+// Digits are packed by 9, so conversion is linear and is cheap comparing to multiplication.
+// Products of limbs shorter than KARATSUBA_LIMBS are calculated by schoolbook method, longer ones by Karatsuba.
+// Quotients longer than NEWTON_DIV_DIGITS are calculated with reciprocal found by Newton iterations.
+struct BigIntLimbs
+{
+    typedef std::vector<uint32_t> Limbs;
+    static const uint32_t BASE = 1'000'000'000;
+    static const int BASE_DIGITS = 9;
+    static const size_t KARATSUBA_LIMBS = 40;    // 360 digits, see --bench-bigint
+    static const unsigned long long SHORT_DIV_MAX = ULLONG_MAX / 10; // r * 10 + digit of short division fits into 64 bits
+    static const size_t SHORT_DIV_DIGITS = 18;   // divisors that are less than 10^18 <= SHORT_DIV_MAX
+    static const size_t NEWTON_DIV_DIGITS = 16;  // shorter quotients are divided by schoolbook method, greater than START of DivNewton
+
+    static void ToLimbs(const BigInt& a, Limbs& r)
+    {
+        size_t n = a.digits.size();
+        r.assign((n + BASE_DIGITS - 1) / BASE_DIGITS, 0);
+        const char* d = a.digits.data();
+        for (size_t i = n; i-- > 0; )
+            r[i / BASE_DIGITS] = r[i / BASE_DIGITS] * 10 + d[i];
+    }
+
+    static void FromLimbs(const Limbs& r, BigInt& a)
+    {
+        a.digits.resize(r.size() * BASE_DIGITS);
+        char* d = a.digits.data();
+        for (size_t i = 0; i < r.size(); i++)
+        {
+            uint32_t v = r[i];
+            for (int k = 0; k < BASE_DIGITS; k++, v /= 10)
+                d[i * BASE_DIGITS + k] = (char)(v % 10);
+        }
+        size_t n = a.digits.size();
+        while (n > 1 && d[n - 1] == 0) n--;
+        a.digits.resize(std::max<size_t>(n, 1));
+    }
+
+    // r[0..n+m) = a * b, r must be filled with zeroes
+    static void MulSchool(const uint32_t* a, size_t n, const uint32_t* b, size_t m, uint32_t* r)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            uint64_t ai = a[i], carry = 0;
+            if (ai == 0) continue;
+            for (size_t j = 0; j < m; j++)
+            {
+                uint64_t cur = r[i + j] + ai * b[j] + carry;
+                r[i + j] = (uint32_t)(cur % BASE);
+                carry = cur / BASE;
+            }
+            r[i + m] = (uint32_t)carry; // limb is not touched by previous rows yet
+        }
+    }
+
+    // dst[0..dstLen) += src[0..srcLen), carry is propagated up to dstLen
+    static void AddTo(uint32_t* dst, size_t dstLen, const uint32_t* src, size_t srcLen)
+    {
+        uint32_t carry = 0;
+        size_t i = 0;
+        for (; i < srcLen; i++)
+        {
+            uint32_t v = dst[i] + src[i] + carry;
+            carry = v >= BASE;
+            dst[i] = carry ? v - BASE : v;
+        }
+        for (; carry && i < dstLen; i++)
+        {
+            uint32_t v = dst[i] + 1;
+            carry = v == BASE;
+            dst[i] = carry ? 0 : v;
+        }
+    }
+
+    // dst[0..dstLen) -= src[0..srcLen), result must not be negative
+    static void SubFrom(uint32_t* dst, size_t dstLen, const uint32_t* src, size_t srcLen)
+    {
+        uint32_t borrow = 0;
+        size_t i = 0;
+        for (; i < srcLen; i++)
+        {
+            uint32_t sub = src[i] + borrow;
+            borrow = dst[i] < sub;
+            dst[i] = borrow ? dst[i] + BASE - sub : dst[i] - sub;
+        }
+        for (; borrow && i < dstLen; i++)
+        {
+            borrow = dst[i] == 0;
+            dst[i] = borrow ? BASE - 1 : dst[i] - 1;
+        }
+    }
+
+    // r[0..2n) = a * b, both numbers have n limbs, r must be filled with zeroes.
+    // a = a1*B^h + a0, b = b1*B^h + b0: a*b = z2*B^2h + (z1 - z2 - z0)*B^h + z0, where z0 = a0*b0, z2 = a1*b1, z1 = (a0+a1)*(b0+b1)
+    static void MulKaratsuba(const uint32_t* a, const uint32_t* b, size_t n, uint32_t* r)
+    {
+        if (n < KARATSUBA_LIMBS)
+        {
+            MulSchool(a, n, b, n, r);
+            return;
+        }
+
+        size_t h = n / 2, hi = n - h;
+        Limbs sa(a + h, a + n), sb(b + h, b + n), z1(2 * hi + 2, 0);
+        sa.push_back(0);
+        sb.push_back(0);
+        AddTo(sa.data(), hi + 1, a, h);
+        AddTo(sb.data(), hi + 1, b, h);
+
+        MulKaratsuba(a, b, h, r);                  // z0
+        MulKaratsuba(a + h, b + h, hi, r + 2 * h); // z2
+        MulKaratsuba(sa.data(), sb.data(), hi + 1, z1.data());
+        SubFrom(z1.data(), z1.size(), r, 2 * h);
+        SubFrom(z1.data(), z1.size(), r + 2 * h, 2 * hi);
+
+        size_t len = z1.size();
+        while (len > 0 && z1[len - 1] == 0) len--;
+        AddTo(r + h, 2 * n - h, z1.data(), len);
+    }
+
+    // r[0..n+m) = a * b, r must be filled with zeroes. longer operand is split into pieces of length of shorter one
+    static void Mul(const uint32_t* a, size_t n, const uint32_t* b, size_t m, uint32_t* r)
+    {
+        if (n < m) std::swap(a, b), std::swap(n, m);
+        if (m < KARATSUBA_LIMBS)
+            MulSchool(a, n, b, m, r);
+        else if (n == m)
+            MulKaratsuba(a, b, n, r);
+        else
+        {
+            Limbs tmp(2 * m);
+            for (size_t i = 0; i < n; i += m)
+            {
+                size_t len = std::min(m, n - i);
+                std::fill(tmp.begin(), tmp.end(), 0);
+                Mul(a + i, len, b, m, tmp.data());
+                AddTo(r + i, n + m - i, tmp.data(), len + m);
+            }
+        }
+    }
+
+    // a = a * 10^k
+    static void ShiftLeft(BigInt& a, size_t k)
+    {
+        if (Null(a) || k == 0) return;
+        size_t n = a.digits.size();
+        a.digits.resize(n + k);
+        char* d = a.digits.data();
+        std::memmove(d + k, d, n);
+        std::memset(d, 0, k);
+    }
+
+    // a = a / 10^k
+    static void ShiftRight(BigInt& a, size_t k)
+    {
+        size_t n = a.digits.size();
+        if (k >= n)
+        {
+            a = BigInt();
+            return;
+        }
+        char* d = a.digits.data();
+        std::memmove(d, d + k, n - k);
+        a.digits.resize(n - k);
+    }
+
+    // q = a / b, r = a % b for divisor that is not greater than SHORT_DIV_MAX, q may be a
+    static void DivShort(const BigInt& a, unsigned long long b, BigInt& q, unsigned long long& r)
+    {
+        size_t n = a.digits.size();
+        q.digits.resize(n);
+        const char* da = a.digits.data();
+        char* dq = q.digits.data();
+        r = 0;
+        for (size_t i = n; i-- > 0; )
+        {
+            r = r * 10 + da[i];
+            dq[i] = (char)(r / b);
+            r %= b;
+        }
+        while (n > 1 && dq[n - 1] == 0) n--;
+        q.digits.resize(n);
+    }
+
+    // a * 10^k for k >= 0, a / 10^-k for k < 0
+    static BigInt Scaled(const BigInt& a, ptrdiff_t k)
+    {
+        BigInt r = a;
+        if (k >= 0) ShiftLeft(r, (size_t)k);
+        else ShiftRight(r, (size_t)-k);
+        return r;
+    }
+
+    // q = a / b, r = a % b by multiplication with reciprocal of b.
+    // X ~ 10^(2j) / (top j digits of b) is found by Newton iterations X += X * (10^(2j) - b*X) / 10^(2j),
+    // each iteration doubles j, so all of them cost about two multiplications of the final size.
+    // Only top m digits of a and b are needed for m-digit quotient, error of the estimate is a few units
+    static void DivNewton(const BigInt& a, const BigInt& b, BigInt& q, BigInt& r)
+    {
+        const ptrdiff_t la = a.digits.size(), lb = b.digits.size();
+        const ptrdiff_t m = la - lb + 3; // digits of quotient and guard digits
+        const ptrdiff_t TOP = 17; // digits of b in the first estimate
+        const ptrdiff_t START = 15; // correct digits of the first estimate
+
+        double bt = 0;
+        for (ptrdiff_t i = lb; i-- > std::max<ptrdiff_t>(0, lb - TOP); )
+            bt = bt * 10 + b.digits[i];
+        bt *= std::pow(10.0, START - std::min(lb, TOP)); // top START digits of b
+        BigInt X((unsigned long long)(1e30 / bt)); // 10^(2*START) / bt
+
+        BigInt P, E, D;
+        for (ptrdiff_t j = START; j < m; )
+        {
+            ptrdiff_t j2 = std::min(2 * j - 2, m); // 2 digits of guard for the errors of truncation
+            ShiftLeft(X, j2 - j);
+            E = Scaled(b, j2 - lb) * X; // ~ 10^(2*j2)
+            P = BigInt(1ull);
+            ShiftLeft(P, 2 * j2);
+            if (E <= P)
+            {
+                D = P - E;
+                D *= X;
+                ShiftRight(D, 2 * j2);
+                X += D;
+            }
+            else
+            {
+                D = E - P;
+                D *= X;
+                ShiftRight(D, 2 * j2);
+                X -= D;
+            }
+            j = j2;
+        }
+
+        // a / b ~ (a * 10^(m-lb)) / (b * 10^(m-lb)) ~ (a * 10^(m-lb)) * X / 10^(2m)
+        q = Scaled(a, m - lb) * X;
+        ShiftRight(q, 2 * m);
+        BigInt qb = q * b;
+        while (a < qb)
+            --q, qb -= b;
+        r = a - qb;
+        while (!(r < b))
+            ++q, r -= b;
+    }
+
+    // q = a / b, r = a % b by long division, one decimal digit of quotient per step.
+    // multiples of b are calculated once, so each digit is found by comparisons only
+    static void DivSchool(const BigInt& a, const BigInt& b, BigInt& q, BigInt& r)
+    {
+        BigInt mul[10];
+        for (int c = 1; c < 10; c++)
+            mul[c] = mul[c - 1] + b;
+
+        size_t n = a.digits.size();
+        q.digits.resize(n);
+        r = BigInt();
+        for (size_t i = n; i-- > 0; )
+        {
+            ShiftLeft(r, 1); // r = r * 10 + next digit of a
+            r.digits[0] = a.digits[i];
+            int c = 9;
+            while (r < mul[c]) c--;
+            if (c > 0) r -= mul[c];
+            q.digits[i] = (char)c;
+        }
+        while (n > 1 && q.digits[n - 1] == 0) n--;
+        q.digits.resize(n);
+    }
+
+    // q = a / b, r = a % b, b is not 0
+    static void DivMod(const BigInt& a, const BigInt& b, BigInt& q, BigInt& r)
+    {
+        size_t la = a.digits.size(), lb = b.digits.size();
+        if (lb <= SHORT_DIV_DIGITS)
+        {
+            unsigned long long rem;
+            DivShort(a, b.to_u64(), q, rem);
+            r = BigInt(rem);
+        }
+        else if (la >= lb + NEWTON_DIV_DIGITS) // long quotient
+            DivNewton(a, b, q, r);
+        else
+            DivSchool(a, b, q, r);
+    }
+};
+
 BigInt& operator*=(BigInt& a, const BigInt& b)
 {
     if (Null(a) || Null(b))
@@ -211,30 +625,18 @@ BigInt& operator*=(BigInt& a, const BigInt& b)
         a = BigInt();
         return a;
     }
-    int n = (int)a.digits.size(), m = (int)b.digits.size();
-    std::vector<int> v(n + m, 0);
-    for (int i = 0; i < n; i++)
-        for (int j = 0; j < m; j++) {
-            v[i + j] += (a.digits[i]) * (b.digits[j]);
-        }
-    n += m;
-    a.digits.resize(v.size());
-    for (int s, i = 0, t = 0; i < n; i++)
-    {
-        s = t + v[i];
-        v[i] = s % 10;
-        t = s / 10;
-        a.digits[i] = (char)v[i];
-    }
-    for (int i = n - 1; i >= 1 && !v[i]; i--)
-        a.digits.pop_back();
+    BigIntLimbs::Limbs x, y;
+    BigIntLimbs::ToLimbs(a, x);
+    BigIntLimbs::ToLimbs(b, y);
+    BigIntLimbs::Limbs r(x.size() + y.size(), 0);
+    BigIntLimbs::Mul(x.data(), x.size(), y.data(), y.size(), r.data());
+    BigIntLimbs::FromLimbs(r, a);
     return a;
 }
 
 BigInt operator*(const BigInt& a, const BigInt& b)
 {
-    BigInt temp;
-    temp = a;
+    BigInt temp(a);
     temp *= b;
     return temp;
 }
@@ -253,25 +655,9 @@ BigInt& operator/=(BigInt& a, const BigInt& b)
         a = BigInt(1);
         return a;
     }
-    int i, lgcat = 0, cc;
-    int n = Length(a);// , m = Length(b);
-    std::vector<int> cat(n, 0);
-    BigInt t;
-    for (i = n - 1; t * 10 + a.digits[i] < b; i--)
-    {
-        t *= 10;
-        t += a.digits[i];
-    }
-    for (; i >= 0; i--) {
-        t = t * 10 + a.digits[i];
-        for (cc = 9; cc * b > t; cc--);
-        t -= cc * b;
-        cat[lgcat++] = cc;
-    }
-    a.digits.resize(cat.size());
-    for (i = 0; i < lgcat; i++)
-        a.digits[i] = (char)cat[lgcat - i - 1];
-    a.digits.resize(lgcat);
+    BigInt q, r;
+    BigIntLimbs::DivMod(a, b, q, r);
+    a = std::move(q);
     return a;
 }
 
@@ -296,35 +682,172 @@ BigInt& operator%=(BigInt& a, const BigInt& b)
         a = BigInt();
         return a;
     }
+    BigInt q, r;
+    BigIntLimbs::DivMod(a, b, q, r);
+    a = std::move(r);
+    return a;
+}
 
-    int i, lgcat = 0, cc;
-    int n = Length(a);// , m = Length(b);
-    std::vector<int> cat(n, 0);
-    BigInt t;
-    for (i = n - 1; t * 10 + a.digits[i] < b; i--)
+BigInt operator%(const BigInt& a, const BigInt& b)
+{
+    BigInt temp;
+    temp = a;
+    temp %= b;
+    return temp;
+}
+
+static const unsigned long long POW10[20] = { 1ull, 10ull, 100ull, 1'000ull, 10'000ull, 100'000ull, 1'000'000ull, 10'000'000ull,
+    100'000'000ull, 1'000'000'000ull, 10'000'000'000ull, 100'000'000'000ull, 1'000'000'000'000ull, 10'000'000'000'000ull,
+    100'000'000'000'000ull, 1'000'000'000'000'000ull, 10'000'000'000'000'000ull, 100'000'000'000'000'000ull,
+    1'000'000'000'000'000'000ull, 10'000'000'000'000'000'000ull };
+
+// number of decimal digits of b (1 for 0), log10 is estimated by log2
+static int digitsCount(unsigned long long b)
+{
+    int t = (std::bit_width(b) * 1233) >> 12; // 1233 / 4096 ~ log10(2)
+    return b < POW10[t] ? std::max(t, 1) : t + 1;
+}
+
+// -1, 0, 1 if a is less, equal or greater than b. Lengths decide for all numbers except ones with as many digits as b
+static int compare(const BigInt& a, unsigned long long b)
+{
+    int n = Length(a), m = digitsCount(b);
+    if (n != m)
+        return n < m ? -1 : 1;
+    if (!a.fits_u64())
+        return 1;
+    unsigned long long v = a.to_u64();
+    return v < b ? -1 : (v > b ? 1 : 0);
+}
+
+bool operator==(const BigInt& a, unsigned long long b)
+{
+    return compare(a, b) == 0;
+}
+
+bool operator!=(const BigInt& a, unsigned long long b)
+{
+    return compare(a, b) != 0;
+}
+
+bool operator>(const BigInt& a, unsigned long long b)
+{
+    return compare(a, b) > 0;
+}
+
+bool operator>=(const BigInt& a, unsigned long long b)
+{
+    return compare(a, b) >= 0;
+}
+
+bool operator<(const BigInt& a, unsigned long long b)
+{
+    return compare(a, b) < 0;
+}
+
+bool operator<=(const BigInt& a, unsigned long long b)
+{
+    return compare(a, b) <= 0;
+}
+
+// digits of b are added one by one, carry goes into b
+BigInt& operator+=(BigInt& a, unsigned long long b)
+{
+    for (size_t i = 0; b; ++i)
+    {
+        if (i == a.digits.size())
+            a.digits.push_back(0);
+        unsigned long long s = a.digits[i] + b % 10;
+        b /= 10;
+        if (s >= 10)
+            s -= 10, b++;
+        a.digits[i] = (char)s;
+    }
+    return a;
+}
+
+BigInt operator+(const BigInt& a, unsigned long long b)
+{
+    BigInt temp(a);
+    temp += b;
+    return temp;
+}
+
+BigInt operator+(BigInt&& a, unsigned long long b)
+{
+    a += b;
+    return std::move(a);
+}
+
+// one pass with carry that is less than b, digit * b + carry fits into 64 bits for b up to ULLONG_MAX / 10
+BigInt& operator*=(BigInt& a, unsigned long long b)
+{
+    if (b > BigIntLimbs::SHORT_DIV_MAX)
+        return a *= BigInt(b);
+    if (b == 0 || Null(a))
     {
-        t *= 10;
-        t += a.digits[i];
+        a = BigInt();
+        return a;
     }
-    for (; i >= 0; i--)
+    size_t n = a.digits.size();
+    char* d = a.digits.data();
+    unsigned long long carry = 0;
+    for (size_t i = 0; i < n; ++i)
     {
-        t = t * 10 + a.digits[i];
-        for (cc = 9; cc * b > t; cc--);
-        t -= cc * b;
-        cat[lgcat++] = cc;
+        unsigned long long cur = d[i] * b + carry;
+        d[i] = (char)(cur % 10);
+        carry = cur / 10;
     }
-    a = t;
+    for (; carry; carry /= 10)
+        a.digits.push_back((char)(carry % 10));
     return a;
 }
 
-BigInt operator%(const BigInt& a, const BigInt& b)
+BigInt operator*(const BigInt& a, unsigned long long b)
 {
-    BigInt temp;
-    temp = a;
-    temp %= b;
+    BigInt temp(a);
+    temp *= b;
+    return temp;
+}
+
+BigInt operator*(unsigned long long a, const BigInt& b)
+{
+    BigInt temp(b);
+    temp *= a;
     return temp;
 }
 
+BigInt& operator/=(BigInt& a, unsigned long long b)
+{
+    if (b == 0)
+        throw TBigIntException("BigInt Arithmetic Error: Division By 0");
+    if (b > BigIntLimbs::SHORT_DIV_MAX)
+        return a /= BigInt(b);
+    unsigned long long r;
+    BigIntLimbs::DivShort(a, b, a, r);
+    return a;
+}
+
+BigInt operator/(const BigInt& a, unsigned long long b)
+{
+    BigInt temp(a);
+    temp /= b;
+    return temp;
+}
+
+// remainder only, quotient is not stored
+unsigned long long operator%(const BigInt& a, unsigned long long b)
+{
+    if (b == 0)
+        throw TBigIntException("BigInt Arithmetic Error: Division By 0");
+    if (b > BigIntLimbs::SHORT_DIV_MAX)
+        return toULongLong(a % BigInt(b));
+    unsigned long long r = 0;
+    for (size_t i = a.digits.size(); i-- > 0; )
+        r = (r * 10 + a.digits[i]) % b;
+    return r;
+}
+
 BigInt& operator^=(BigInt& a, const BigInt& b)
 {
     BigInt Exponent, Base(a);
@@ -359,63 +882,159 @@ void divide_by_2(BigInt& a)
         a.digits.pop_back();
 }
 
+// (3a+1)/2 == (15a+5)/10 for odd a, so it is computed by one pass from the least significant digit
+// and shift by one decimal digit. the lowest digit of 15a+5 is always 0
+void mul3add1_half(BigInt& a)
+{
+    char* d = a.digits.data();
+    size_t n = a.digits.size();
+    int carry = 5;
+    for (size_t i = 0; i < n; i++)
+    {
+        int v = d[i] * 15 + carry;
+        if (i > 0) d[i - 1] = (char)(v % 10);
+        carry = v / 10;
+    }
+
+    // carry < 15, result is not shorter than a
+    d[n - 1] = (char)(carry % 10);
+    if (carry >= 10)
+        a.digits.push_back((char)(carry / 10));
+}
+
+void halve(BigInt& a, unsigned int k)
+{
+    const int mask = (1 << k) - 1;
+    char* d = a.digits.data();
+    int rem = 0;
+    for (int i = (int)a.digits.size() - 1; i >= 0; i--)
+    {
+        int cur = rem * 10 + d[i]; // < 2^k * 10, fits into int for k <= HALVE_MAX
+        d[i] = (char)(cur >> k);
+        rem = cur & mask;
+    }
+    while (a.digits.size() > 1 && !a.digits.back())
+        a.digits.pop_back();
+}
+
+// 10^18 is divisible by 2^18, so a mod 2^18 equals (last 18 digits) mod 2^18
+unsigned int count_trailing_even(const BigInt& a)
+{
+    uint64_t low = 0;
+    for (int i = (int)std::min<size_t>(a.digits.size(), HALVE_MAX) - 1; i >= 0; i--)
+        low = low * 10 + a.digits[i];
+
+    low &= (1ull << HALVE_MAX) - 1;
+    return low == 0 ? HALVE_MAX : (unsigned int)std::countr_zero(low);
+}
+
+// Newton iterations x = (x + a/x) / 2 from a number that is not less than sqrt(a), sequence decreases till floor(sqrt(a)).
+// first estimate of short numbers is square root of 16 or 17 top digits of a (~8 correct digits),
+// of long ones it is found recursively from a / 10^(2h), so it has half of correct digits and two iterations are enough
+static BigInt sqrtFloor(const BigInt& a)
+{
+    const size_t DOUBLE_DIGITS = 32;
+    size_t len = Length(a);
+    BigInt x;
+    if (len <= DOUBLE_DIGITS)
+    {
+        size_t top = std::min<size_t>(len, 16);
+        if ((len - top) % 2) top++; // a = at * 10^e, e is even
+        double at = 0;
+        for (size_t i = len; i-- > len - top; )
+            at = at * 10 + a[(int)i];
+
+        x = BigInt((unsigned long long)std::sqrt(at + 1) + 1ull);
+        BigIntLimbs::ShiftLeft(x, (len - top) / 2);
+    }
+    else
+    {
+        size_t h = len / 4;
+        BigInt at = a;
+        BigIntLimbs::ShiftRight(at, 2 * h);
+        x = sqrtFloor(at);
+        ++x; // (x + 1)^2 * 10^(2h) > a
+        BigIntLimbs::ShiftLeft(x, h);
+    }
+
+    while (true)
+    {
+        BigInt y = a / x;
+        y += x;
+        divide_by_2(y);
+        if (!(y < x)) break;
+        x = std::move(y);
+    }
+    return x;
+}
+
 BigInt sqrt(BigInt& a)
 {
-    BigInt left(1), right(a), v(1), mid, prod;
-    divide_by_2(right);
-    while (left <= right) {
-        mid += left;
-        mid += right;
-        divide_by_2(mid);
-        prod = (mid * mid);
-        if (prod <= a) {
-            v = mid;
-            ++mid;
-            left = mid;
-        }
-        else {
-            --mid;
-            right = mid;
+    if (Null(a))
+        return a;
+    return sqrtFloor(a);
+}
+
+// product of numbers lo..hi (1 if range is empty). range is split in halves, so multiplied numbers have close lengths
+// and long products are done by Karatsuba. numbers of short ranges are multiplied in uint64_t while it does not overflow
+static BigInt rangeProduct(uint64_t lo, uint64_t hi)
+{
+    const uint64_t LEAF = 16;
+    if (lo > hi)
+        return BigInt(1ull);
+    if (hi - lo < LEAF)
+    {
+        BigInt p(1ull);
+        uint64_t acc = 1;
+        for (uint64_t i = lo; i <= hi; i++)
+        {
+            if (acc > ULLONG_MAX / i)
+                p *= acc, acc = 1;
+            acc *= i;
         }
-        mid = BigInt();
+        p *= acc;
+        return p;
     }
-    return v;
+    uint64_t mid = lo + (hi - lo) / 2;
+    BigInt p = rangeProduct(lo, mid);
+    p *= rangeProduct(mid + 1, hi);
+    return p;
 }
 
+// C(n) = (2n)! / (n! * (n+1)!) = ((n+2) * ... * 2n) / n!
 BigInt NthCatalan(int n)
 {
-    BigInt a(1), b;
-    for (int i = 2; i <= n; i++)
-        a *= i;
-    b = a;
-    for (int i = n + 1; i <= 2 * n; i++)
-        b *= i;
-    a *= a;
-    a *= (n + 1);
-    b /= a;
+    if (n < 2)
+        return BigInt(1ull);
+    BigInt b = rangeProduct(n + 2, 2 * (uint64_t)n);
+    b /= rangeProduct(2, n);
     return b;
 }
 
+// fast doubling: F(2k) = F(k) * (2*F(k+1) - F(k)), F(2k+1) = F(k)^2 + F(k+1)^2
 BigInt NthFibonacci(int n)
 {
-    BigInt a(1), b(1), c;
-    if (!n)
-        return c;
-    n--;
-    while (n--) {
-        c = a + b;
-        b = a;
-        a = c;
+    BigInt a, b(1ull), c, d; // a = F(k), b = F(k+1)
+    if (n <= 0)
+        return a;
+    for (int bit = std::bit_width((unsigned int)n) - 1; bit >= 0; bit--)
+    {
+        c = b + b;
+        c -= a;
+        c *= a;
+        d = a * a;
+        d += b * b;
+        if ((n >> bit) & 1)
+            a = std::move(d), b = c + a;
+        else
+            a = std::move(c), b = std::move(d);
     }
-    return b;
+    return a;
 }
 
 BigInt Factorial(int n)
 {
-    BigInt f(1);
-    for (int i = 2; i <= n; i++)
-        f *= i;
-    return f;
+    return rangeProduct(2, n < 2 ? 1 : n);
 }
 
 std::istream& operator>>(std::istream& in, BigInt& a)
@@ -435,11 +1054,69 @@ std::istream& operator>>(std::istream& in, BigInt& a)
 
 std::ostream& operator<<(std::ostream& out, const BigInt& a)
 {
-    for (int i = (int)a.digits.size() - 1; i >= 0; i--)
-        out << (std::string::value_type)(a.digits[i] + '0');
-        //out << (short)a.digits[i];
-    //out << std::endl; // end-of-bigint-reading sign
-    return out;
+    char buf[256];
+    if (char* end = a.ToChars(buf, buf + sizeof(buf)))
+        return out << std::string_view(buf, end - buf); // stream width and fill are applied to the whole number
+
+    return out << (std::string)a;
+}
+
+size_t BigInt::CharsCount(char separator) const
+{
+    size_t n = digits.size();
+    return separator && n > 0 ? n + (n - 1) / 3 : n;
+}
+
+char* BigInt::ToChars(char* first, char* last, char separator) const
+{
+    size_t len = CharsCount(separator);
+    if ((size_t)(last - first) < len)
+        return nullptr;
+
+    if (!separator)
+        return std::transform(digits.rbegin(), digits.rend(), first, [](char ch) { return (char)(ch + '0'); });
+
+    // digits are stored from the least significant one, so buffer is filled from the end
+    char* p = first + len;
+    for (size_t i = 0; i < digits.size(); i++)
+    {
+        if (separator && i > 0 && i % 3 == 0) *--p = separator;
+        *--p = (char)(digits[i] + '0');
+    }
+    return first + len;
+}
+
+char* ToChars(char* first, char* last, uint64_t value, char separator)
+{
+    char tmp[32]; // 20 digits and 6 separators
+    char* p = tmp + sizeof(tmp);
+    int n = 0;
+    do
+    {
+        if (separator && n > 0 && n % 3 == 0) *--p = separator;
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+        n++;
+    } while (value > 0);
+
+    size_t len = tmp + sizeof(tmp) - p;
+    if ((size_t)(last - first) < len)
+        return nullptr;
+    std::memcpy(first, p, len);
+    return first + len;
+}
+
+unsigned long long toULongLong(const BigInt& b)
+{
+    unsigned long long res = 0;
+    for (int i = Length(b) - 1; i >= 0; i--)
+    {
+        unsigned long long d = b.digits[i];
+        if (res > (ULLONG_MAX - d) / 10)
+            return ULLONG_MAX;
+        res = res * 10 + d;
+    }
+    return res;
 }
 
 
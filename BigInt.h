@@ -7,7 +7,13 @@
 #include <iostream>
 #include <sstream>
 #include <format>
+#include <string_view>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <bit>
 
 //using namespace std;
 
@@ -26,10 +32,169 @@ private:
     std::string Text;
 };
 
+// Thread-local cache of heap buffers of BigIntDigits (numbers longer than BigIntDigits::INLINE_SIZE digits).
+// Buffer sizes are rounded up to powers of 2, freed buffers are kept in free lists of the thread that frees them
+// and reused by next allocations of the same size, so in steady state threaded calculation does not call
+// global allocator and threads do not contend for its lock.
+// Each buffer is allocated separately by global operator new, so it may be freed by any thread
+// (results of worker threads are freed by reducer thread) and nothing dangles when a thread finishes.
+class BigIntArena
+{
+public:
+    static constexpr uint32_t MIN_BLOCK = 64;              // smallest buffer, greater than BigIntDigits::INLINE_SIZE
+    static constexpr uint32_t CLASSES = 16;                // buffers up to MIN_BLOCK << (CLASSES - 1) (2M digits) are cached
+    static constexpr uint32_t MAX_CACHED = 256;            // max free buffers of one size kept by a thread
+    static constexpr uint32_t MAX_CACHED_BYTES = 1 << 20;  // and max memory of them
+
+    // returns buffer of at least size bytes, size is set to the actual size of buffer
+    static char* Allocate(size_t& size);
+    // size must be the one returned by Allocate
+    static void Free(char* p, size_t size);
+    // returns cached buffers of current thread to global allocator, called automatically at thread exit
+    static void Release();
+    // number of buffers reused from the cache by current thread, they are not seen by global operator new
+    static uint64_t CachedAllocations();
+};
+
+// Storage of decimal digits with small-buffer optimization.
+// Numbers up to INLINE_SIZE digits (2^128 has 39 digits) are kept inside the object, so copies and temporaries
+// of such numbers do not allocate. Longer numbers are kept in heap buffers of BigIntArena.
+// Object does not point to itself, so it may be moved by memcpy as std::string of MSVC.
+// Interface is the subset of std::string used by BigInt, resize() and append() fill new digits with 0.
+class BigIntDigits
+{
+public:
+    static const uint32_t INLINE_SIZE = 40;
+
+private:
+    uint32_t m_size = 0;
+    uint32_t m_capacity = INLINE_SIZE; // INLINE_SIZE means digits are in m_inline, heap capacity is always greater
+    union
+    {
+        char m_inline[INLINE_SIZE];
+        char* m_heap;
+    };
+
+    bool isInline() const { return m_capacity == INLINE_SIZE; }
+
+    void grow(size_t n)
+    {
+        size_t cap = std::max<size_t>(n, (size_t)m_capacity * 2);
+        char* p = BigIntArena::Allocate(cap);
+        std::memcpy(p, data(), m_size);
+        if (!isInline()) BigIntArena::Free(m_heap, m_capacity);
+        m_heap = p;
+        m_capacity = (uint32_t)cap;
+    }
+
+public:
+    BigIntDigits() {}
+
+    BigIntDigits(const BigIntDigits& a)
+    {
+        reserve(a.m_size);
+        std::memcpy(data(), a.data(), a.m_size);
+        m_size = a.m_size;
+    }
+
+    BigIntDigits(BigIntDigits&& a) noexcept
+    {
+        m_size = a.m_size;
+        m_capacity = a.m_capacity;
+        if (a.isInline())
+            std::memcpy(m_inline, a.m_inline, m_size);
+        else
+            m_heap = a.m_heap, a.m_capacity = INLINE_SIZE;
+        a.m_size = 0;
+    }
+
+    ~BigIntDigits()
+    {
+        if (!isInline()) BigIntArena::Free(m_heap, m_capacity);
+    }
+
+    BigIntDigits& operator=(const BigIntDigits& a)
+    {
+        if (this != &a)
+        {
+            reserve(a.m_size); // heap buffer is reused if it is big enough
+            std::memcpy(data(), a.data(), a.m_size);
+            m_size = a.m_size;
+        }
+        return *this;
+    }
+
+    BigIntDigits& operator=(BigIntDigits&& a) noexcept
+    {
+        if (this != &a)
+        {
+            if (!isInline()) BigIntArena::Free(m_heap, m_capacity);
+            m_size = a.m_size;
+            m_capacity = a.m_capacity;
+            if (a.isInline())
+                std::memcpy(m_inline, a.m_inline, m_size);
+            else
+                m_heap = a.m_heap, a.m_capacity = INLINE_SIZE;
+            a.m_size = 0;
+        }
+        return *this;
+    }
+
+    char* data() { return isInline() ? m_inline : m_heap; }
+    const char* data() const { return isInline() ? m_inline : m_heap; }
+    size_t size() const { return m_size; }
+    size_t length() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    char& operator[](size_t i) { return data()[i]; }
+    char operator[](size_t i) const { return data()[i]; }
+    char back() const { return data()[m_size - 1]; }
+
+    char* begin() { return data(); }
+    char* end() { return data() + m_size; }
+    const char* begin() const { return data(); }
+    const char* end() const { return data() + m_size; }
+    std::reverse_iterator<const char*> rbegin() const { return std::reverse_iterator<const char*>(end()); }
+    std::reverse_iterator<const char*> rend() const { return std::reverse_iterator<const char*>(begin()); }
+
+    void reserve(size_t n)
+    {
+        if (n > m_capacity) grow(n);
+    }
+
+    void clear() { m_size = 0; }
+
+    void push_back(char ch)
+    {
+        if (m_size == m_capacity) grow(m_size + 1);
+        data()[m_size++] = ch;
+    }
+
+    void pop_back() { m_size--; }
+
+    void append(size_t n, char ch)
+    {
+        reserve(m_size + n);
+        std::memset(data() + m_size, ch, n);
+        m_size += (uint32_t)n;
+    }
+
+    void resize(size_t n)
+    {
+        if (n > m_size) append(n - m_size, 0);
+        else m_size = (uint32_t)n;
+    }
+
+    friend bool operator==(const BigIntDigits& a, const BigIntDigits& b)
+    {
+        return a.m_size == b.m_size && std::memcmp(a.data(), b.data(), a.m_size) == 0;
+    }
+};
+
 class BigInt 
 {
 private:
-    std::string digits;
+    BigIntDigits digits;
 public:
 
     //Constructors:
@@ -37,20 +202,49 @@ public:
     BigInt(std::string& s);
     BigInt(const char* s);
     BigInt(const BigInt& a);
+    BigInt(BigInt&& a) noexcept = default;
 
     bool IsEven() { if (digits.length() == 0) return true; else return digits[0] % 2 == 0; };
     bool HasTrailingZeros(unsigned int zeroes = 1) { for (unsigned int i = 0; i < zeroes; i++) if (digits[i] != 0) return false; return true; }
+    bool IsOne() const { return digits.size() == 1 && digits[0] == 1; }
+
+    // number is not greater than ULLONG_MAX
+    bool fits_u64() const
+    {
+        const size_t MAX_DIGITS = 20;
+        if (digits.size() != MAX_DIGITS) return digits.size() < MAX_DIGITS;
+        const char* max = "18446744073709551615"; // ULLONG_MAX from the most significant digit
+        for (size_t i = 0; i < MAX_DIGITS; ++i)
+            if (digits[MAX_DIGITS - 1 - i] != max[i] - '0') return digits[MAX_DIGITS - 1 - i] < max[i] - '0';
+        return true;
+    }
+
+    // value of number that fits_u64(), no checks (toULongLong() saturates)
+    unsigned long long to_u64() const
+    {
+        unsigned long long res = 0;
+        for (size_t i = digits.size(); i-- > 0; )
+            res = res * 10 + digits[i];
+        return res;
+    }
 
     //Helper Functions:
     friend void divide_by_2(BigInt& a);
+    friend void mul3add1_half(BigInt& a);
+    friend void halve(BigInt& a, unsigned int k);
+    friend unsigned int count_trailing_even(const BigInt& a);
     friend bool Null(const BigInt& a);
     friend int Length(const BigInt& a);
+    friend double Log2(const BigInt& a);
+    friend uint64_t IntLog2(const BigInt& a);
+    friend unsigned long long toULongLong(const BigInt& b);
     int operator[](const int index)const;
 
     /* * * * Operator Overloading * * * */
 
     //Direct assignment
     BigInt& operator=(const BigInt&);
+    BigInt& operator=(BigInt&&) noexcept = default;
 
     //Post/Pre - Incrementation
     BigInt& operator++();
@@ -61,7 +255,9 @@ public:
     //Addition and Subtraction
     friend BigInt& operator+=(BigInt&, const BigInt&);
     friend BigInt operator+(const BigInt&, const BigInt&);
+    friend BigInt operator+(BigInt&&, const BigInt&); // result is built in the storage of temporary
     friend BigInt operator-(const BigInt&, const BigInt&);
+    friend BigInt operator-(BigInt&&, const BigInt&);
     friend BigInt& operator-=(BigInt&, const BigInt&);
 
     //Comparison operators
@@ -83,6 +279,23 @@ public:
     friend BigInt operator%(const BigInt&, const BigInt&);
     friend BigInt& operator%=(BigInt&, const BigInt&);
 
+    //Operations with machine words, they do not create temporary BigInt
+    friend bool operator==(const BigInt&, unsigned long long);
+    friend bool operator!=(const BigInt&, unsigned long long);
+    friend bool operator>(const BigInt&, unsigned long long);
+    friend bool operator>=(const BigInt&, unsigned long long);
+    friend bool operator<(const BigInt&, unsigned long long);
+    friend bool operator<=(const BigInt&, unsigned long long);
+    friend BigInt& operator+=(BigInt&, unsigned long long);
+    friend BigInt operator+(const BigInt&, unsigned long long);
+    friend BigInt operator+(BigInt&&, unsigned long long);
+    friend BigInt& operator*=(BigInt&, unsigned long long);
+    friend BigInt operator*(const BigInt&, unsigned long long);
+    friend BigInt operator*(unsigned long long, const BigInt&);
+    friend BigInt& operator/=(BigInt&, unsigned long long);
+    friend BigInt operator/(const BigInt&, unsigned long long);
+    friend unsigned long long operator%(const BigInt&, unsigned long long);
+
     //Power Function
     friend BigInt& operator^=(BigInt&, const BigInt&);
     friend BigInt operator^(BigInt&, const BigInt&);
@@ -91,19 +304,16 @@ public:
 
     operator std::string() const 
     {
-        // implementation #1
-        std::string dig = digits;
-        std::reverse(dig.begin(), dig.end());
+        std::string dig(digits.rbegin(), digits.rend());
         std::transform(dig.begin(), dig.end(), dig.begin(), [](int ch) -> char { return (char)ch + '0'; });
         return dig;
-        
-        /*
-        // implementation #2, is this faster?
-        std::stringstream s;
-        s << *this;
-        return s.str();*/
     }
 
+    // Formatting without allocations. Writes decimal digits into [first, last), groups of 3 digits are separated by separator
+    // if it is not 0. Returns pointer past the last written char or nullptr if buffer is too small.
+    char* ToChars(char* first, char* last, char separator = 0) const;
+    size_t CharsCount(char separator = 0) const; // number of chars written by ToChars
+
     //Square Root Function
     friend BigInt sqrt(BigInt& a);
 
@@ -115,10 +325,22 @@ public:
     friend BigInt NthCatalan(int n);
     friend BigInt NthFibonacci(int n);
     friend BigInt Factorial(int n);
+    friend struct BigIntLimbs; // multiplication and division of long numbers, see BigInt.cpp
 };
 
 void divide_by_2(BigInt& a);
 
+// Karatsuba multiplication, Newton division and square root make them usable for thousands of digits
+BigInt NthCatalan(int n);
+BigInt NthFibonacci(int n);
+BigInt Factorial(int n); // binary splitting
+
+// In-place primitives of Collatz step, no temporaries and no allocations (except growth of the number by one digit)
+inline constexpr unsigned int HALVE_MAX = 18; // max k of halve() and result of count_trailing_even()
+void mul3add1_half(BigInt& a);            // a = (3a+1)/2 for odd a, one carry pass
+void halve(BigInt& a, unsigned int k = 1); // a = a/2^k, k <= HALVE_MAX, one pass
+unsigned int count_trailing_even(const BigInt& a); // how many times a can be halved while it is even, up to HALVE_MAX
+
 template<class IntImpl>
 unsigned long long toULongLong(IntImpl b)
 {
@@ -137,31 +359,62 @@ inline unsigned long long toULongLong<uint64_t>(uint64_t b)
     return b;
 }
 
-// Specialization std::formatter to use BigInt variables in std:format() calls
+// direct conversion without stringstream, returns ULLONG_MAX if number does not fit (as stream conversion does)
+unsigned long long toULongLong(const BigInt& b);
+
+// same as BigInt::ToChars for uint64_t, so both IntImpl types can be formatted by the same code
+char* ToChars(char* first, char* last, uint64_t value, char separator = 0);
+
+inline char* ToChars(char* first, char* last, const BigInt& value, char separator = 0)
+{
+    return value.ToChars(first, last, separator);
+}
+
+// number at offset from the first number of a range.
+// loops over ranges count uint64_t offsets instead of comparing IntImpl numbers, current number is incremented in place
+// and positions of records are kept as offsets, so wide numbers are built only when records are reported
+template<typename IntImpl>
+IntImpl RangeNumber(const IntImpl& base, uint64_t offset)
+{
+    IntImpl res = base;
+    res += offset;
+    return res;
+}
+
+// approximate log2 of a number, BigInt is converted by its most significant digits
+double Log2(const BigInt& a);
+
+inline double Log2(uint64_t a)
+{
+    return std::log2((double)a);
+}
+
+// floor(log2) of a positive number
+inline uint64_t IntLog2(uint64_t a)
+{
+    return std::bit_width(a) - 1;
+}
+
+// exact, unlike (uint64_t)Log2(a) that is wrong near powers of 2 for numbers of 17+ digits
+uint64_t IntLog2(const BigInt& a);
+
+// Specialization std::formatter to use BigInt variables in std:format() calls.
+// Digits are grouped by 3 and written into stack buffer, then through ctx.out() with width and alignment of format spec
 template <>
-struct std::formatter<BigInt> : std::formatter<std::string> //: std::formatter<std::string_view>
+struct std::formatter<BigInt> : std::formatter<std::string_view>
 {
-    /*constexpr auto parse(std::format_parse_context& ctx) 
-    {
-        return ctx.begin();
-    }*/
+    static const size_t BUF_SIZE = 512; // enough for numbers up to 384 digits, longer ones are formatted via std::string
 
     auto format(const BigInt& p, std::format_context& ctx) const
     {
         const char separator = ' ';
-        std::string digits = p;
-        std::string result;
-        int count = 0;
-        for (auto it = digits.rbegin(); it != digits.rend(); ++it) 
-        {
-            if (count && count % 3 == 0) result += separator;
-            result += *it;
-            ++count;
-        }
+        char buf[BUF_SIZE];
+        if (char* end = p.ToChars(buf, buf + BUF_SIZE, separator))
+            return std::formatter<std::string_view>::format(std::string_view(buf, end - buf), ctx);
 
-        std::reverse(result.begin(), result.end());
-       // return std::format_to(ctx.out(), "{}", result);
-        return std::formatter<std::string>::format(result, ctx);
+        std::string result(p.CharsCount(separator), separator);
+        p.ToChars(result.data(), result.data() + result.size(), separator);
+        return std::formatter<std::string_view>::format(result, ctx);
     }
 };
 
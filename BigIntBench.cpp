@@ -0,0 +1,215 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <limits>
+#include <new>
+#include <cstdlib>
+#include <algorithm>
+#include <format>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "BigIntBench.h"
+#include "BigInt.h"
+
+#ifdef USE_ALLOC_COUNTER
+// Replacement of global operator new counts allocations of each thread.
+// Counter is thread local, so it costs one increment per allocation and does not slow down threaded calculation.
+// Default nothrow forms call the replaced ones, so they are counted too
+static thread_local uint64_t t_allocations = 0;
+
+uint64_t ThreadAllocations()
+{
+    return t_allocations + BigIntArena::CachedAllocations();
+}
+
+void* operator new(std::size_t size)
+{
+    t_allocations++;
+    if (size == 0) size = 1;
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    t_allocations++;
+    size_t a = (size_t)align;
+    size = std::max<std::size_t>(a, (size + a - 1) / a * a); // aligned_alloc requires size multiple of alignment
+#ifdef _WIN32
+    if (void* p = _aligned_malloc(size, a))
+#else
+    if (void* p = std::aligned_alloc(a, size))
+#endif
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+    return ::operator new(size, align);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete[](void* p, std::align_val_t align) noexcept
+{
+    ::operator delete(p, align);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t align) noexcept
+{
+    ::operator delete(p, align);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t align) noexcept
+{
+    ::operator delete(p, align);
+}
+#else
+uint64_t ThreadAllocations()
+{
+    return 0;
+}
+#endif
+
+static volatile uint64_t g_sink = 0; // results of measured operations go here, so compiler cannot throw them away
+
+// random number with specified amount of decimal digits
+static BigInt randomBigInt(std::mt19937_64& rnd, uint64_t digits)
+{
+    std::string s(digits, '0');
+    s[0] = (char)('1' + rnd() % 9);
+    for (uint64_t i = 1; i < digits; i++)
+        s[i] = (char)('0' + rnd() % 10);
+    return BigInt(s);
+}
+
+BigIntBench::BigIntBench(uint64_t maxDigits): m_maxDigits(maxDigits == 0 ? MAX_DIGITS_DEF : maxDigits)
+{
+}
+
+template<typename F>
+void BigIntBench::measure(const char* op, uint64_t digits, F&& f)
+{
+    g_sink = g_sink + f(); // warm-up
+
+    uint64_t iters = 1, allocs;
+    double sec;
+    while (true)
+    {
+        uint64_t allocs0 = ThreadAllocations();
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (uint64_t i = 0; i < iters; i++)
+            g_sink = g_sink + f();
+        auto t1 = std::chrono::high_resolution_clock::now();
+        allocs = ThreadAllocations() - allocs0;
+        sec = std::chrono::duration<double>(t1 - t0).count();
+
+        if (sec >= MIN_TIME_SEC) break;
+        iters *= sec < MIN_TIME_SEC / 10 ? 10 : 2;
+    }
+
+    if (ALLOCATIONS_COUNTED)
+        std::cout << std::format("{:<14} {:>6} {:>16.1f} {:>10.2f}", op, digits, sec * 1e9 / iters, (double)allocs / iters) << std::endl;
+    else
+        std::cout << std::format("{:<14} {:>6} {:>16.1f} {:>10}", op, digits, sec * 1e9 / iters, "n/a") << std::endl;
+}
+
+void BigIntBench::Run()
+{
+    const uint64_t sizes[] = { 20, 38, 50, 100, 200, 500, 1'000, 2'000, 5'000, 10'000 };
+
+    std::mt19937_64 rnd(20231231); // fixed seed, operands are the same in every run
+    const BigInt one(1ull), two(2ull), three(3ull);
+    const uint64_t limit = 1'000'000'007ull; // machine word operand, BigInt has overloads for it
+
+    std::cout << "BigInt micro-benchmark, operand sizes up to " << m_maxDigits << " digits" << std::endl;
+    std::cout << std::format("{:<14} {:>6} {:>16} {:>10}", "Operation", "Digits", "ns/op", "allocs/op") << std::endl;
+
+    for (uint64_t digits : sizes)
+    {
+        if (digits > m_maxDigits) break;
+
+        BigInt a = randomBigInt(rnd, digits);
+        BigInt b = randomBigInt(rnd, digits);
+        BigInt half = randomBigInt(rnd, std::max<uint64_t>(1, digits / 2));
+        BigInt tmp;
+
+        measure("copy", digits, [&] { tmp = a; return (uint64_t)Length(tmp); });
+        measure("a < b", digits, [&] { return (uint64_t)(a < b); });
+        measure("a + b", digits, [&] { BigInt c = a + b; return (uint64_t)Length(c); });
+        measure("++a", digits, [&] { tmp = a; ++tmp; return (uint64_t)Length(tmp); }); // next number of range loop
+        measure("a += 1", digits, [&] { tmp = a; tmp += one; return (uint64_t)Length(tmp); });
+        measure("3 * a", digits, [&] { BigInt c = three * a; return (uint64_t)Length(c); });
+        measure("(3a+1)/2", digits, [&] { BigInt c = (three * a + one) / two; return (uint64_t)Length(c); }); // odd step of Calc3p1<BigInt>
+        measure("a+a+a+1", digits, [&] { tmp = a + a + a + one; divide_by_2(tmp); return (uint64_t)Length(tmp); }); // odd step of Calc3p1 template
+        measure("a / 2", digits, [&] { BigInt c = a / two; return (uint64_t)Length(c); });
+        measure("divide_by_2", digits, [&] { tmp = a; divide_by_2(tmp); return (uint64_t)Length(tmp); });
+        measure("mul3add1_half", digits, [&] { tmp = a; if (tmp.IsEven()) tmp += one; mul3add1_half(tmp); return (uint64_t)Length(tmp); }); // fused odd step
+        measure("halve(a, k)", digits, [&] { tmp = a; halve(tmp, count_trailing_even(tmp)); return (uint64_t)Length(tmp); }); // all halvings of even step
+        measure("a * b", digits, [&] { BigInt c = a * b; return (uint64_t)Length(c); });
+        measure("a / (n/2 dig)", digits, [&] { BigInt c = a / half; return (uint64_t)Length(c); });
+        measure("a % (n/2 dig)", digits, [&] { BigInt c = a % half; return (uint64_t)Length(c); });
+        measure("sqrt(a)", digits, [&] { BigInt c = sqrt(a); return (uint64_t)Length(c); });
+        measure("a < u64", digits, [&] { return (uint64_t)(a < limit); }); // check of unused numbers
+        measure("a != 1ull", digits, [&] { return (uint64_t)(a != 1ull); });
+        measure("a + u64", digits, [&] { BigInt c = a + limit; return (uint64_t)Length(c); }); // number of range by offset
+        measure("a * 3ull", digits, [&] { BigInt c = a * 3ull; return (uint64_t)Length(c); });
+        measure("a / u64", digits, [&] { BigInt c = a / limit; return (uint64_t)Length(c); });
+        measure("a % u64", digits, [&] { return (uint64_t)(a % limit); });
+        measure("to string", digits, [&] { std::string s = a; return (uint64_t)s.size(); });
+        measure("ToChars", digits, [&] { char buf[16'000]; return (uint64_t)(a.ToChars(buf, buf + sizeof(buf), ' ') - buf); });
+
+        if (digits == 20) // toULongLong makes sense only for numbers that fit into uint64_t
+        {
+            BigInt u(std::numeric_limits<uint64_t>::max() - 12345);
+            measure("toULongLong", digits, [&] { return toULongLong(u); });
+        }
+    }
+
+    // sequences, second column is n instead of digits
+    const int ns[] = { 100, 1'000, 5'000, 10'000 };
+    for (int n : ns)
+    {
+        if ((uint64_t)n > m_maxDigits) break;
+
+        measure("Factorial", n, [&] { BigInt c = Factorial(n); return (uint64_t)Length(c); });
+        measure("NthFibonacci", n, [&] { BigInt c = NthFibonacci(n); return (uint64_t)Length(c); });
+        measure("NthCatalan", n, [&] { BigInt c = NthCatalan(n); return (uint64_t)Length(c); });
+    }
+}
+
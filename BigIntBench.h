@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// number of memory allocations made by current thread, counted by replacement of global operator new (see BigIntBench.cpp),
+// including buffers of BigInt reused from BigIntArena: they would be allocations without the arena.
+// Replacement affects every allocation of the process, not only benchmarks, so it is compiled in only with USE_ALLOC_COUNTER defined
+// (build for benchmarks). Otherwise allocations are not counted (ALLOCATIONS_COUNTED is false) and ThreadAllocations returns 0
+#ifdef USE_ALLOC_COUNTER
+constexpr bool ALLOCATIONS_COUNTED = true;
+#else
+constexpr bool ALLOCATIONS_COUNTED = false;
+#endif
+uint64_t ThreadAllocations();
+
+// Micro-benchmark of BigInt primitives, option --bench-bigint.
+// Each primitive is measured for operand sizes from 20 to 10'000 decimal digits,
+// ns/op and allocations/op are reported. Operands are random numbers generated with fixed seed,
+// so results of different builds are comparable.
+// Factorial, NthFibonacci and NthCatalan are measured for n up to max digits too.
+class BigIntBench
+{
+private:
+	static constexpr double MIN_TIME_SEC = 0.1; // each measurement is repeated until it takes at least this time
+
+	uint64_t m_maxDigits;
+
+	template<typename F>
+	void measure(const char* op, uint64_t digits, F&& f);
+
+public:
+	static const uint64_t MAX_DIGITS_DEF = 10'000;
+
+	BigIntBench(uint64_t maxDigits = MAX_DIGITS_DEF);
+
+	void Run();
+};
+
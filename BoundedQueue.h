@@ -0,0 +1,92 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// Simple bounded multi-producer/multi-consumer queue.
+// Used to connect stages of threaded calculation: compute workers -> reducer -> writer.
+// Producers that must never block (compute workers) use TryPush(), other stages use Push().
+template<typename T>
+class BoundedQueue
+{
+private:
+	std::deque<T> m_items;
+	size_t m_capacity;
+	bool m_closed = false;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_notEmpty;
+	std::condition_variable m_notFull;
+
+public:
+	BoundedQueue(size_t capacity): m_capacity(capacity)
+	{
+	}
+
+	// puts item into the queue if there is free space, never blocks.
+	// item is left untouched when function returns false
+	bool TryPush(T& item)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_closed || m_items.size() >= m_capacity) return false;
+			m_items.push_back(std::move(item));
+		}
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	// puts item into the queue, waits for free space if queue is full
+	// returns false if queue is closed
+	bool Push(T&& item)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+			if (m_closed) return false;
+			m_items.push_back(std::move(item));
+		}
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	// takes item from the queue, waits till item is available
+	// returns false when queue is closed and there are no more items
+	bool Pop(T& item)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+			if (m_items.empty()) return false;
+			item = std::move(m_items.front());
+			m_items.pop_front();
+		}
+		m_notFull.notify_one();
+		return true;
+	}
+
+	// no more items will be pushed. consumers take remaining items and then Pop() returns false
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+		}
+		m_notEmpty.notify_all();
+		m_notFull.notify_all();
+	}
+
+	void Reopen()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_items.clear();
+		m_closed = false;
+	}
+
+	size_t Size() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_items.size();
+	}
+};
+
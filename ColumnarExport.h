@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+#include "Utils.h"
+
+// Export of steps and max value of every number of threaded calculation, option --columns-out.
+// Numbers are stored in blocks of ColumnEncoder::BLOCK_SIZE consecutive numbers, each block has two columns:
+//   steps     - zigzag varint of difference with steps of previous number of the block
+//   max value - zigzag varint of difference of round(log2(maxvalue) * LOG2_SCALE) with previous number of the block
+// Values are reset at the beginning of each block, so every block is decoded independently.
+//
+// File format (integers are var_len_encode varints unless noted):
+//   header:  "3N1COLUMNS1\n" "<first number of range> <LOG2_SCALE> <BLOCK_SIZE>\n"
+//   block:   first (offset of first number from the range start), count, steps bytes, max value bytes, steps column, max value column
+//   index:   for each block sorted by first: first, count, position of block in file
+//   footer:  position of index (uint64_t LE), number of blocks (uint64_t LE), "3N1COLIX"
+// Blocks are written in order of completion by worker threads, index gives order of numbers.
+class ColumnarExport
+{
+public:
+	static constexpr const char* SIGNATURE = "3N1COLUMNS1\n";
+	static constexpr const char* INDEX_SIGNATURE = "3N1COLIX";
+	static const uint32_t LOG2_SCALE = 256; // max value is stored with precision 1/256 of log2, i.e. ~0.3%
+
+private:
+	struct BlockInfo
+	{
+		uint64_t first;
+		uint64_t count;
+		uint64_t pos;
+	};
+
+	std::ofstream m_file;
+	std::mutex m_mutex;
+	uint64_t m_pos = 0; // current size of the file
+	uint64_t m_numbers = 0;
+	std::vector<BlockInfo> m_index;
+
+	void writeVarLen(std::vector<uint8_t>& buf, uint64_t value)
+	{
+		uint8_t tmp[9];
+		size_t len = var_len_encode(tmp, value);
+		buf.insert(buf.end(), tmp, tmp + len);
+	}
+
+public:
+	void Open(const std::string& fileName, const std::string& start, uint64_t blockSize)
+	{
+		m_file.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (m_file.fail())
+			throw std::invalid_argument("Error: cannot open file '" + fileName + "'\n");
+
+		std::string header = std::string(SIGNATURE) + start + ' ' + std::to_string(LOG2_SCALE) + ' ' + std::to_string(blockSize) + '\n';
+		m_file.write(header.data(), header.size());
+		m_pos = header.size();
+		m_numbers = 0;
+		m_index.clear();
+	}
+
+	bool IsOpen() const
+	{
+		return m_file.is_open();
+	}
+
+	uint64_t Numbers() const { return m_numbers; }
+	uint64_t Bytes() const { return m_pos; }
+
+	// called by worker threads, columns are already encoded, so the lock is held for file write only
+	void WriteBlock(uint64_t first, uint64_t count, const std::vector<uint8_t>& steps, const std::vector<uint8_t>& maxvalues)
+	{
+		std::vector<uint8_t> head;
+		writeVarLen(head, first);
+		writeVarLen(head, count);
+		writeVarLen(head, steps.size());
+		writeVarLen(head, maxvalues.size());
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_index.push_back(BlockInfo{ first, count, m_pos });
+		m_file.write((const char*)head.data(), head.size());
+		m_file.write((const char*)steps.data(), steps.size());
+		m_file.write((const char*)maxvalues.data(), maxvalues.size());
+		m_pos += head.size() + steps.size() + maxvalues.size();
+		m_numbers += count;
+	}
+
+	// writes block index and footer, called after all workers are finished
+	void Close()
+	{
+		if (!m_file.is_open()) return;
+
+		std::sort(m_index.begin(), m_index.end(), [](const BlockInfo& a, const BlockInfo& b) { return a.first < b.first; });
+
+		std::vector<uint8_t> buf;
+		for (auto& b : m_index)
+		{
+			writeVarLen(buf, b.first);
+			writeVarLen(buf, b.count);
+			writeVarLen(buf, b.pos);
+		}
+
+		uint64_t footer[2] = { m_pos, m_index.size() };
+		m_file.write((const char*)buf.data(), buf.size());
+		m_file.write((const char*)footer, sizeof(footer));
+		m_file.write(INDEX_SIGNATURE, strlen(INDEX_SIGNATURE));
+		m_pos += buf.size() + sizeof(footer) + strlen(INDEX_SIGNATURE);
+		m_file.close();
+		if (m_file.fail())
+			throw std::runtime_error("Error: cannot write columns file\n");
+	}
+};
+
+// Encoder of columns of one worker thread, it is kept in the thread context so buffers are reused
+class ColumnEncoder
+{
+public:
+	static const uint64_t BLOCK_SIZE = 1 << 16; // numbers per block
+
+private:
+	std::vector<uint8_t> m_steps;
+	std::vector<uint8_t> m_maxvalues;
+	uint64_t m_first = 0; // offset of first number of current block
+	uint64_t m_count = 0;
+	uint64_t m_prevSteps = 0;
+	int64_t m_prevLog = 0;
+
+	static uint64_t zigzag(int64_t v)
+	{
+		return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+	}
+
+	static void put(std::vector<uint8_t>& buf, uint64_t value)
+	{
+		uint8_t tmp[9];
+		size_t len = var_len_encode(tmp, value);
+		buf.insert(buf.end(), tmp, tmp + len);
+	}
+
+public:
+	// starts a new block with number at offset first
+	void Begin(uint64_t first)
+	{
+		m_steps.clear();
+		m_maxvalues.clear();
+		m_first = first;
+		m_count = 0;
+		m_prevSteps = 0;
+		m_prevLog = 0;
+	}
+
+	// adds next number, returns true when block is full and should be flushed
+	bool Add(uint64_t steps, double log2max)
+	{
+		int64_t log = std::llround(log2max * ColumnarExport::LOG2_SCALE);
+		put(m_steps, zigzag((int64_t)(steps - m_prevSteps)));
+		put(m_maxvalues, zigzag(log - m_prevLog));
+		m_prevSteps = steps;
+		m_prevLog = log;
+		return ++m_count == BLOCK_SIZE;
+	}
+
+	// writes current block if it is not empty and begins the next one
+	void Flush(ColumnarExport& out)
+	{
+		if (m_count > 0)
+			out.WriteBlock(m_first, m_count, m_steps, m_maxvalues);
+		Begin(m_first + m_count);
+	}
+};
@@ -0,0 +1,586 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <bit>
+#include <vector>
+#include <istream>
+#include <ostream>
+
+#include "BigInt.h"
+
+// Compressed bitset of unused numbers (option -u), roaring bitmap style, for ranges that do not fit into memory as MyBitset.
+// Bits are split into chunks of 2^16, each chunk is kept in the smallest container for its bits:
+//   empty  - nothing is allocated, chunk headers are calloc-ed like words of MyBitset, so pages of untouched
+//            regions are not even committed by OS;
+//   array  - sorted offsets of set bits, up to ARRAY_MAX of them;
+//   bitmap - 1024 words (8 KB), set bit costs the same as in MyBitset;
+//   run    - sorted runs of set bits, 4 bytes per run.
+// Every number of calculated range is set sooner or later, so its chunks become full and are turned into one run.
+// In concurrent mode (see SetConcurrent) setTrue may be called by many threads at once: full chunks and bits set already
+// in bitmaps are detected without locking, other chunks are changed under spinlock of the chunk. get(), CountTrue() and Optimize() are not
+// synchronized with setTrue, they are called when calculation is finished. Write() may be called during calculation.
+class CompressedBitset
+{
+private:
+	static constexpr uint64_t CHUNK_2POWER = 16;
+	static constexpr uint64_t CHUNK_BITS = 1ull << CHUNK_2POWER;
+	static constexpr uint64_t CHUNK_MASK = CHUNK_BITS - 1;
+	static constexpr uint32_t BITMAP_WORDS = CHUNK_BITS / 64;
+	static constexpr uint32_t ARRAY_MIN_CAPACITY = 4;
+	// arrays up to 4096 offsets take less memory than bitmap, but insertion into long array is slow:
+	// 512 is ~20% faster than 4096 on sparse trajectories for ~15% more memory
+	static constexpr uint32_t ARRAY_MAX = 512;
+
+	enum Kind : uint8_t { EMPTY, ARRAY, BITMAP, RUN };
+
+	// all zero bytes is an empty chunk, card, lock, kind, data and words of bitmap are accessed through std::atomic_ref while threads calculate
+	struct Chunk
+	{
+		uint32_t card;  // set bits of ARRAY and RUN, CHUNK_BITS - chunk is full and never changes anymore
+		uint8_t lock;
+		uint8_t kind;
+		uint16_t count; // allocated offsets of ARRAY, full words of BITMAP, runs of RUN
+		void* data;     // uint16_t offsets of ARRAY, uint64_t words of BITMAP, uint16_t pairs (first, last) of RUN
+	};
+
+	uint64_t m_bits = 0;
+	uint64_t m_chunksCnt = 0;
+	Chunk* m_chunks = nullptr;
+	bool m_concurrent = false;
+	// bitmaps of chunks that became full in concurrent mode. setTrue may still read such bitmap through the pointer it took
+	// before, so bitmaps are not freed but reused for new bitmaps, and freed when concurrent mode is over
+	std::vector<uint64_t*> m_spare;
+	uint8_t m_spareLock = 0;
+
+	static void lock(Chunk& c)
+	{
+		std::atomic_ref<uint8_t> l(c.lock);
+		while (l.exchange(1, std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+
+	static void unlock(Chunk& c)
+	{
+		std::atomic_ref<uint8_t>(c.lock).store(0, std::memory_order_release);
+	}
+
+	// card is changed under lock of the chunk, but it is read without lock to skip full chunks
+	static void setCard(Chunk& c, uint32_t card)
+	{
+		std::atomic_ref<uint32_t>(c.card).store(card, std::memory_order_release);
+	}
+
+	static bool getInChunk(const Chunk& c, uint16_t low)
+	{
+		switch (c.kind)
+		{
+		case ARRAY:
+		{
+			const uint16_t* a = (const uint16_t*)c.data;
+			return std::binary_search(a, a + c.card, low);
+		}
+		case BITMAP:
+			return (((const uint64_t*)c.data)[low >> 6] >> (low & 63)) & 1;
+		case RUN:
+		{
+			const uint16_t* r = (const uint16_t*)c.data;
+			uint32_t lo = 0, hi = c.count; // first run that starts after low
+			while (lo < hi)
+			{
+				uint32_t mid = (lo + hi) / 2;
+				if (r[2 * mid] <= low) lo = mid + 1;
+				else hi = mid;
+			}
+			return lo > 0 && low <= r[2 * (lo - 1) + 1];
+		}
+		default:
+			return false;
+		}
+	}
+
+	static uint32_t popcount(const Chunk& c)
+	{
+		if (c.kind != BITMAP)
+			return c.card;
+		uint32_t cnt = 0;
+		for (uint32_t i = 0; i < BITMAP_WORDS; i++)
+			cnt += std::popcount(((const uint64_t*)c.data)[i]);
+		return cnt;
+	}
+
+	static size_t containerBytes(const Chunk& c)
+	{
+		switch (c.kind)
+		{
+		case ARRAY: return c.count * sizeof(uint16_t);
+		case BITMAP: return BITMAP_WORDS * sizeof(uint64_t);
+		case RUN: return c.count * 2 * sizeof(uint16_t);
+		default: return 0;
+		}
+	}
+
+	uint64_t* newBitmap()
+	{
+		uint64_t* w = nullptr;
+		if (m_concurrent)
+		{
+			std::atomic_ref<uint8_t> l(m_spareLock);
+			while (l.exchange(1, std::memory_order_acquire))
+				std::this_thread::yield();
+			if (!m_spare.empty())
+			{
+				w = m_spare.back();
+				m_spare.pop_back();
+			}
+			l.store(0, std::memory_order_release);
+		}
+		if (!w) return (uint64_t*)calloc(BITMAP_WORDS, sizeof(uint64_t));
+		memset(w, 0, BITMAP_WORDS * sizeof(uint64_t));
+		return w;
+	}
+
+	void toBitmap(Chunk& c)
+	{
+		uint64_t* w = newBitmap();
+		const uint16_t* d = (const uint16_t*)c.data;
+		if (c.kind == ARRAY)
+		{
+			for (uint32_t i = 0; i < c.card; i++)
+				w[d[i] >> 6] |= 1ull << (d[i] & 63);
+		}
+		else if (c.kind == RUN)
+		{
+			for (uint32_t i = 0; i < c.count; i++)
+				for (uint32_t b = d[2 * i]; b <= d[2 * i + 1]; b++)
+					w[b >> 6] |= 1ull << (b & 63);
+		}
+		free(c.data); // array or run, setTrue reads data of bitmaps only
+		c.count = (uint16_t)std::count(w, w + BITMAP_WORDS, ~0ull);
+		setCard(c, 0);
+		std::atomic_ref<void*>(c.data).store(w, std::memory_order_release);
+		std::atomic_ref<uint8_t>(c.kind).store(BITMAP, std::memory_order_release);
+	}
+
+	// full chunk is one run, it is not changed anymore and setTrue does not touch it.
+	// card is set before data, so setTrue that gets the run instead of bitmap sees full chunk
+	void toFull(Chunk& c)
+	{
+		uint64_t* w = (uint64_t*)c.data;
+		uint16_t* r = (uint16_t*)malloc(2 * sizeof(uint16_t));
+		r[0] = 0;
+		r[1] = (uint16_t)CHUNK_MASK;
+		c.count = 1;
+		setCard(c, (uint32_t)CHUNK_BITS);
+		std::atomic_ref<void*>(c.data).store(r, std::memory_order_release);
+		std::atomic_ref<uint8_t>(c.kind).store(RUN, std::memory_order_release);
+
+		if (!m_concurrent)
+		{
+			free(w);
+			return;
+		}
+		std::atomic_ref<uint8_t> l(m_spareLock);
+		while (l.exchange(1, std::memory_order_acquire))
+			std::this_thread::yield();
+		m_spare.push_back(w);
+		l.store(0, std::memory_order_release);
+	}
+
+	void freeSpare()
+	{
+		for (uint64_t* w : m_spare)
+			free(w);
+		m_spare.clear();
+	}
+
+	// first bit equal to value at or after b, CHUNK_BITS if there is no such bit
+	static uint32_t findBit(const uint64_t* w, uint32_t b, bool value)
+	{
+		while (b < CHUNK_BITS)
+		{
+			uint64_t word = (value ? w[b >> 6] : ~w[b >> 6]) >> (b & 63);
+			if (word) return b + std::countr_zero(word);
+			b = (b | 63) + 1;
+		}
+		return (uint32_t)CHUNK_BITS;
+	}
+
+	// number of runs of set bits in bitmap
+	static uint32_t bitmapRuns(const uint64_t* w)
+	{
+		uint32_t runs = 0;
+		uint64_t prev = 0;
+		for (uint32_t i = 0; i < BITMAP_WORDS; i++)
+		{
+			runs += std::popcount(w[i] & ~((w[i] << 1) | (prev >> 63))); // bits that start a run
+			prev = w[i];
+		}
+		return runs;
+	}
+
+	static void bitmapToRuns(Chunk& c, uint32_t runs)
+	{
+		const uint64_t* w = (const uint64_t*)c.data;
+		uint16_t* r = (uint16_t*)malloc(runs * 2 * sizeof(uint16_t));
+		uint32_t n = 0, card = 0;
+		for (uint32_t b = findBit(w, 0, true); b < CHUNK_BITS; b = findBit(w, b, true))
+		{
+			uint32_t end = findBit(w, b, false);
+			r[2 * n] = (uint16_t)b;
+			r[2 * n + 1] = (uint16_t)(end - 1);
+			n++;
+			card += end - b;
+			b = end;
+		}
+		free(c.data);
+		c.data = r;
+		c.kind = RUN;
+		c.count = (uint16_t)n;
+		setCard(c, card);
+	}
+
+	static void arrayToRuns(Chunk& c, uint32_t runs)
+	{
+		const uint16_t* a = (const uint16_t*)c.data;
+		uint32_t n = c.card, k = 0;
+		uint16_t* r = (uint16_t*)malloc(runs * 2 * sizeof(uint16_t));
+		for (uint32_t i = 0; i < n; i++)
+		{
+			if (i == 0 || a[i] != a[i - 1] + 1)
+				r[2 * k++] = a[i];
+			r[2 * k - 1] = a[i];
+		}
+		free(c.data);
+		c.data = r;
+		c.kind = RUN;
+		c.count = (uint16_t)runs;
+	}
+
+	void setInChunk(Chunk& c, uint16_t low)
+	{
+		if (c.kind == BITMAP) // dense chunk, the most frequent case after full ones
+		{
+			uint64_t* w = (uint64_t*)c.data;
+			uint64_t old = w[low >> 6], word = old | (1ull << (low & 63));
+			if (word == old) return;
+			std::atomic_ref<uint64_t>(w[low >> 6]).store(word, std::memory_order_relaxed); // read by setTrue without lock
+			if (word == ~0ull && ++c.count == BITMAP_WORDS)
+				toFull(c);
+			return;
+		}
+
+		if (c.kind == EMPTY)
+		{
+			c.data = malloc(ARRAY_MIN_CAPACITY * sizeof(uint16_t));
+			c.kind = ARRAY;
+			c.count = ARRAY_MIN_CAPACITY;
+		}
+		else if (c.kind == RUN) // runs are created by Optimize() only, chunk that is filled further is bitmap again
+		{
+			if (getInChunk(c, low)) return;
+			toBitmap(c);
+			setInChunk(c, low);
+			return;
+		}
+
+		uint16_t* a = (uint16_t*)c.data;
+		uint32_t n = c.card;
+		uint16_t* p = std::lower_bound(a, a + n, low);
+		if (p != a + n && *p == low) return;
+		if (n == ARRAY_MAX)
+		{
+			toBitmap(c);
+			setInChunk(c, low);
+			return;
+		}
+		if (n == c.count)
+		{
+			size_t pos = p - a;
+			c.count = (uint16_t)std::min<uint32_t>(c.count * 2, ARRAY_MAX);
+			a = (uint16_t*)realloc(a, c.count * sizeof(uint16_t));
+			c.data = a;
+			p = a + pos;
+		}
+		memmove(p + 1, p, (a + n - p) * sizeof(uint16_t));
+		*p = low;
+		setCard(c, n + 1);
+	}
+
+	// calls fn(base + b) for each false bit b of chunk in [b, end), returns false if fn stopped iteration
+	template<typename Fn>
+	static bool forEachFalseInChunk(const Chunk& c, uint64_t base, uint32_t b, uint32_t end, Fn& fn)
+	{
+		switch (c.kind)
+		{
+		case BITMAP:
+		{
+			const uint64_t* w = (const uint64_t*)c.data;
+			for (uint32_t i = b >> 6; i < (end + 63) >> 6; i++)
+			{
+				uint64_t word = ~w[i];
+				if (i == b >> 6)
+					word &= ~0ull << (b & 63);
+				for (; word; word &= word - 1)
+				{
+					uint32_t bit = (i << 6) + std::countr_zero(word);
+					if (bit >= end || !fn(base + bit)) return bit >= end;
+				}
+			}
+			return true;
+		}
+		case ARRAY:
+		{
+			const uint16_t* a = (const uint16_t*)c.data;
+			const uint16_t* p = std::lower_bound(a, a + c.card, (uint16_t)b);
+			for (; b < end; b++)
+			{
+				if (p != a + c.card && *p == b) p++;
+				else if (!fn(base + b)) return false;
+			}
+			return true;
+		}
+		case RUN:
+		{
+			const uint16_t* r = (const uint16_t*)c.data;
+			for (uint32_t i = 0; i <= c.count && b < end; i++)
+			{
+				uint32_t first = i < c.count ? r[2 * i] : end; // zeros before run i
+				for (; b < std::min(first, end); b++)
+					if (!fn(base + b)) return false;
+				if (i < c.count)
+					b = std::max<uint32_t>(b, r[2 * i + 1] + 1);
+			}
+			return true;
+		}
+		default:
+			for (; b < end; b++)
+				if (!fn(base + b)) return false;
+			return true;
+		}
+	}
+
+public:
+	CompressedBitset() {}
+
+	CompressedBitset(uint64_t bitsCount)
+	{
+		Init(bitsCount);
+	}
+
+	CompressedBitset(const CompressedBitset&) = delete;
+	CompressedBitset& operator=(const CompressedBitset&) = delete;
+
+	~CompressedBitset()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		freeSpare();
+		for (uint64_t i = 0; i < m_chunksCnt; i++)
+			free(m_chunks[i].data);
+		free(m_chunks);
+		m_chunks = nullptr;
+		m_chunksCnt = 0;
+		m_bits = 0;
+	}
+
+	void Init(uint64_t bitsCount)
+	{
+		Clear();
+		m_bits = bitsCount;
+		m_chunksCnt = (bitsCount + CHUNK_BITS - 1) / CHUNK_BITS;
+		m_chunks = (Chunk*)calloc(m_chunksCnt, sizeof(Chunk)); // initialises memory to zero, so all chunks are empty
+	}
+
+	// chunks are locked by setTrue while several threads calculate, single thread does not pay for locks
+	void SetConcurrent(bool concurrent)
+	{
+		m_concurrent = concurrent;
+		if (!concurrent) freeSpare();
+	}
+
+	inline uint64_t BitsCount() const
+	{
+		return m_bits;
+	}
+
+	inline bool get(uint64_t bitIndex) const
+	{
+		assert(bitIndex < m_bits);
+		return getInChunk(m_chunks[bitIndex >> CHUNK_2POWER], (uint16_t)(bitIndex & CHUNK_MASK));
+	}
+
+	inline void setTrue(BigInt& bitIndex)
+	{
+		setTrue(bitIndex.to_u64());
+	}
+
+	inline void setTrue(uint64_t bitIndex)
+	{
+		assert(bitIndex < m_bits);
+		Chunk& c = m_chunks[bitIndex >> CHUNK_2POWER];
+		if (std::atomic_ref<uint32_t>(c.card).load(std::memory_order_acquire) == CHUNK_BITS) return; // full chunk, most numbers of calculated range
+
+		// bits are never cleared while threads calculate and bitmap is replaced only when all its bits are set,
+		// so bit that is set in the bitmap, even in the one just replaced (it is kept in m_spare), is set in the chunk
+		if (std::atomic_ref<uint8_t>(c.kind).load(std::memory_order_acquire) == BITMAP)
+		{
+			uint64_t* w = (uint64_t*)std::atomic_ref<void*>(c.data).load(std::memory_order_acquire);
+			if (std::atomic_ref<uint32_t>(c.card).load(std::memory_order_acquire) == CHUNK_BITS) return; // w may be run of full chunk
+			if (std::atomic_ref<uint64_t>(w[(bitIndex & CHUNK_MASK) >> 6]).load(std::memory_order_relaxed) >> (bitIndex & 63) & 1) return;
+		}
+
+		if (!m_concurrent)
+		{
+			setInChunk(c, (uint16_t)(bitIndex & CHUNK_MASK));
+			return;
+		}
+		lock(c);
+		setInChunk(c, (uint16_t)(bitIndex & CHUNK_MASK));
+		unlock(c);
+	}
+
+	// number of bits set to true, chunks are split between threadsCnt threads
+	uint64_t CountTrue(uint64_t threadsCnt = 1) const
+	{
+		threadsCnt = std::max<uint64_t>(1, std::min(threadsCnt, m_chunksCnt / 64)); // thread is not worth it for less than 64 chunks
+		std::vector<uint64_t> counts(threadsCnt, 0);
+		auto countPart = [&](uint64_t part)
+		{
+			uint64_t cnt = 0;
+			for (uint64_t i = m_chunksCnt * part / threadsCnt; i < m_chunksCnt * (part + 1) / threadsCnt; i++)
+				cnt += popcount(m_chunks[i]);
+			counts[part] = cnt;
+		};
+
+		std::vector<std::thread> threads;
+		for (uint64_t part = 1; part < threadsCnt; part++)
+			threads.emplace_back(countPart, part);
+		countPart(0);
+		for (auto& t : threads)
+			t.join();
+
+		uint64_t cnt = 0;
+		for (uint64_t c : counts)
+			cnt += c;
+		return cnt;
+	}
+
+	// calls fn(bitIndex) for each bit set to false starting from bitIndex from, stops when fn returns false.
+	// zeros of bitmaps are found by words, full chunks are skipped at once
+	template<typename Fn>
+	void ForEachFalse(uint64_t from, Fn fn) const
+	{
+		for (uint64_t i = from >> CHUNK_2POWER; i < m_chunksCnt; i++)
+		{
+			const Chunk& c = m_chunks[i];
+			if (c.card == CHUNK_BITS) continue;
+
+			uint64_t base = i << CHUNK_2POWER;
+			uint32_t b = i == from >> CHUNK_2POWER ? (uint32_t)(from & CHUNK_MASK) : 0;
+			uint32_t end = (uint32_t)std::min<uint64_t>(CHUNK_BITS, m_bits - base);
+			if (!forEachFalseInChunk(c, base, b, end, fn)) return;
+		}
+	}
+
+	// memory taken by bitset, bytes
+	uint64_t MemoryUsage() const
+	{
+		uint64_t bytes = m_chunksCnt * sizeof(Chunk);
+		for (uint64_t i = 0; i < m_chunksCnt; i++)
+			bytes += containerBytes(m_chunks[i]);
+		return bytes;
+	}
+
+	// turns bitmaps and arrays into runs where runs are smaller, called when calculation is finished
+	void Optimize()
+	{
+		for (uint64_t i = 0; i < m_chunksCnt; i++)
+		{
+			Chunk& c = m_chunks[i];
+			if (c.kind == ARRAY)
+			{
+				const uint16_t* a = (const uint16_t*)c.data;
+				uint32_t runs = 0;
+				for (uint32_t k = 0; k < c.card; k++)
+					runs += k == 0 || a[k] != a[k - 1] + 1;
+				if (runs * 2 < c.count)
+					arrayToRuns(c, runs);
+			}
+			else if (c.kind == BITMAP)
+			{
+				uint32_t runs = bitmapRuns((const uint64_t*)c.data);
+				if (runs * 2 * sizeof(uint16_t) < BITMAP_WORDS * sizeof(uint64_t))
+					bitmapToRuns(c, runs);
+			}
+		}
+	}
+
+	// binary image of non-empty chunks: index, kind, count of entries (offsets, words or runs) and entries for each of them,
+	// UINT64_MAX after the last one. chunks are locked one by one, so it may be written while bits are set
+	void Write(std::ostream& f)
+	{
+		for (uint64_t index = 0; index < m_chunksCnt; index++)
+		{
+			Chunk& c = m_chunks[index];
+			lock(c);
+			if (c.kind != EMPTY)
+			{
+				uint32_t entries = c.kind == ARRAY ? c.card : (c.kind == BITMAP ? BITMAP_WORDS : c.count);
+				size_t entryBytes = c.kind == BITMAP ? sizeof(uint64_t) : (c.kind == RUN ? 2 * sizeof(uint16_t) : sizeof(uint16_t));
+				f.write((const char*)&index, sizeof(index));
+				f.write((const char*)&c.kind, sizeof(c.kind));
+				f.write((const char*)&entries, sizeof(entries));
+				f.write((const char*)c.data, entries * entryBytes);
+			}
+			unlock(c);
+		}
+		const uint64_t END = UINT64_MAX;
+		f.write((const char*)&END, sizeof(END));
+	}
+
+	// reads image written by Write() into bitset initialized with the same BitsCount(), returns false if image is corrupted
+	bool Read(std::istream& f)
+	{
+		while (true)
+		{
+			uint64_t index;
+			uint8_t kind;
+			uint32_t entries;
+			if (!f.read((char*)&index, sizeof(index))) return false;
+			if (index == UINT64_MAX) return true;
+			f.read((char*)&kind, sizeof(kind));
+			f.read((char*)&entries, sizeof(entries));
+			if (!f || index >= m_chunksCnt || entries == 0 || (kind == ARRAY && entries > ARRAY_MAX)
+				|| (kind == BITMAP && entries != BITMAP_WORDS) || (kind == RUN && entries > CHUNK_BITS / 2) || kind == EMPTY || kind > RUN)
+				return false;
+
+			Chunk& c = m_chunks[index];
+			free(c.data);
+			c.kind = kind;
+			c.count = kind == BITMAP ? 0 : (uint16_t)entries;
+			c.data = malloc(containerBytes(c));
+			if (!f.read((char*)c.data, containerBytes(c))) return false;
+
+			uint32_t card = kind == ARRAY ? entries : 0;
+			if (kind == BITMAP)
+				c.count = (uint16_t)std::count((const uint64_t*)c.data, (const uint64_t*)c.data + BITMAP_WORDS, ~0ull);
+			else if (kind == RUN)
+				for (uint32_t i = 0; i < entries; i++)
+				{
+					const uint16_t* r = (const uint16_t*)c.data;
+					if (r[2 * i] > r[2 * i + 1]) return false;
+					card += r[2 * i + 1] - r[2 * i] + 1;
+				}
+			setCard(c, card);
+		}
+	}
+};
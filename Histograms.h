@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <format>
+#include <algorithm>
+#include <stdexcept>
+
+// Distribution of steps and of log2(maxvalue) of calculated numbers.
+// Each worker thread has its own Histograms, they are merged at the end of calculation, so there is no sharing
+// in the hot loop: one increment of each histogram per number.
+// Max value is counted by floor(log2(maxvalue)), values above LOG2_BUCKETS-1 go into the last bucket.
+class Histograms
+{
+public:
+	static const uint64_t STEPS_BUCKETS = 65536; // steps are stored as uint16_t in ThreeN1Data
+	static const uint64_t LOG2_BUCKETS = 4096;   // maxvalue up to 2^4095 (~1200 decimal digits)
+
+private:
+	std::vector<uint64_t> m_steps;
+	std::vector<uint64_t> m_log2;
+	uint64_t m_count = 0;
+
+public:
+	Histograms(): m_steps(STEPS_BUCKETS), m_log2(LOG2_BUCKETS)
+	{
+	}
+
+	void Add(uint64_t steps, uint64_t log2max)
+	{
+		m_steps[std::min(steps, STEPS_BUCKETS - 1)]++;
+		m_log2[std::min(log2max, LOG2_BUCKETS - 1)]++;
+		m_count++;
+	}
+
+	void Merge(const Histograms& h)
+	{
+		for (uint64_t i = 0; i < STEPS_BUCKETS; i++) m_steps[i] += h.m_steps[i];
+		for (uint64_t i = 0; i < LOG2_BUCKETS; i++) m_log2[i] += h.m_log2[i];
+		m_count += h.m_count;
+	}
+
+	void Clear()
+	{
+		std::fill(m_steps.begin(), m_steps.end(), 0);
+		std::fill(m_log2.begin(), m_log2.end(), 0);
+		m_count = 0;
+	}
+
+	uint64_t Count() const
+	{
+		return m_count;
+	}
+
+	double MeanSteps() const
+	{
+		double sum = 0;
+		for (uint64_t i = 0; i < STEPS_BUCKETS; i++) sum += (double)i * m_steps[i];
+		return m_count > 0 ? sum / m_count : 0;
+	}
+
+	// smallest steps value that is not less than q (0..1) of all numbers
+	uint64_t StepsPercentile(double q) const
+	{
+		uint64_t need = (uint64_t)(q * m_count), acc = 0;
+		for (uint64_t i = 0; i < STEPS_BUCKETS; i++)
+		{
+			acc += m_steps[i];
+			if (acc > need || acc == m_count) return i;
+		}
+		return 0;
+	}
+
+	std::string Summary() const
+	{
+		uint64_t mode = std::max_element(m_log2.begin(), m_log2.end()) - m_log2.begin();
+		return std::format("Steps: mean {:.2f} median {} p90 {} p99 {} | most frequent max value: 2^{}..2^{}",
+			MeanSteps(), StepsPercentile(0.5), StepsPercentile(0.9), StepsPercentile(0.99), mode, mode + 1);
+	}
+
+	// text file, one non-empty bucket per line: "steps <steps> <count>" and "log2max <floor(log2(maxvalue))> <count>"
+	void Save(const std::string& fileName, const std::string& start, const std::string& finish) const
+	{
+		std::ofstream f(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (f.fail())
+			throw std::invalid_argument("Error: cannot open file '" + fileName + "'\n");
+
+		f << "# range " << start << ' ' << finish << " numbers " << m_count << '\n';
+		for (uint64_t i = 0; i < STEPS_BUCKETS; i++)
+			if (m_steps[i] > 0) f << "steps " << i << ' ' << m_steps[i] << '\n';
+		for (uint64_t i = 0; i < LOG2_BUCKETS; i++)
+			if (m_log2[i] > 0) f << "log2max " << i << ' ' << m_log2[i] << '\n';
+	}
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <new>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+
+#include "Utils.h"
+
+// Array with 64-bit indexes in memory of huge pages (see HugePages), it is used for values cache instead of THArray:
+// index of THArray is uint, so cache of more than 4G numbers was silently addressed modulo 2^32.
+// Interface is the same as THArray has for the cache. Items of trivial types are not initialized by SetCount,
+// except that memory of new capacity is zero-filled
+template<typename T>
+class HugeArray
+{
+private:
+	static constexpr uint64_t MIN_CAPACITY = 16;
+
+	HugePages m_mem;
+	T* m_data = nullptr;
+	uint64_t m_count = 0;
+	uint64_t m_capacity = 0;
+
+public:
+	typedef T item_type;
+
+	HugeArray() {}
+
+	~HugeArray()
+	{
+		Clear();
+	}
+
+	HugeArray(const HugeArray&) = delete;
+	HugeArray& operator=(const HugeArray&) = delete;
+
+	void Clear()
+	{
+		std::destroy_n(m_data, m_count);
+		m_mem.Free();
+		m_data = nullptr;
+		m_count = 0;
+		m_capacity = 0;
+	}
+
+	void SetCapacity(uint64_t capacity)
+	{
+		if (capacity <= m_capacity) return;
+
+		HugePages mem;
+		T* data = (T*)mem.Alloc(capacity * sizeof(T));
+		if constexpr (std::is_trivially_copyable_v<T>)
+		{
+			if (m_count > 0) memcpy(data, m_data, m_count * sizeof(T));
+		}
+		else
+		{
+			std::uninitialized_move_n(m_data, m_count, data);
+			std::destroy_n(m_data, m_count);
+		}
+
+		m_mem.Swap(mem);
+		m_data = data;
+		m_capacity = capacity;
+	}
+
+	void SetCount(uint64_t count)
+	{
+		SetCapacity(count);
+		if constexpr (!std::is_trivially_default_constructible_v<T>)
+		{
+			if (count > m_count) std::uninitialized_value_construct_n(m_data + m_count, count - m_count);
+			else std::destroy_n(m_data + count, m_count - count);
+		}
+		m_count = count;
+	}
+
+	uint64_t AddValue(const T& value)
+	{
+		if (m_count == m_capacity)
+			SetCapacity(std::max(MIN_CAPACITY, m_capacity * 2));
+		new (m_data + m_count) T(value);
+		return m_count++;
+	}
+
+	inline uint64_t Count() const
+	{
+		return m_count;
+	}
+
+	inline T& operator[](uint64_t index)
+	{
+		assert(index < m_count);
+		return m_data[index];
+	}
+
+	inline const T& operator[](uint64_t index) const
+	{
+		assert(index < m_count);
+		return m_data[index];
+	}
+
+	inline T* GetValuePointer(uint64_t index)
+	{
+		assert(index < m_count);
+		return m_data + index;
+	}
+
+	HugePages::Kind PagesKind() const
+	{
+		return m_mem.GetKind();
+	}
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <chrono>
+#include <stdexcept>
+#include <format>
+
+// Machine-readable metrics stream, option --metrics-out.
+// Each line of the file is one JSON object with "event" field:
+//   progress - written once per second in threaded mode and once per 1M numbers in single thread mode
+//   record   - new record of steps or max value
+// Events are written by several threads (progress loop, reducer), so writing is serialized by mutex.
+// Numbers of IntImpl type are written as strings, they may not fit into double.
+class MetricsWriter
+{
+private:
+	std::ofstream m_file;
+	std::mutex m_mutex;
+	std::chrono::steady_clock::time_point m_start;
+
+public:
+	void Open(const std::string& fileName)
+	{
+		m_file.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (m_file.fail())
+			throw std::invalid_argument("Error: cannot open file '" + fileName + "'\n");
+		m_start = std::chrono::steady_clock::now();
+	}
+
+	bool IsOpen() const
+	{
+		return m_file.is_open();
+	}
+
+	// seconds since metrics file is opened
+	double Elapsed() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+	}
+
+	// fields are JSON members without braces, e.g. "\"numbers\": 10"
+	void Write(const char* event, const std::string& fields)
+	{
+		auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		std::string line = std::format("{{\"event\": \"{}\", \"time\": {}, \"elapsed\": {:.3f}, {}}}\n", event, now, Elapsed(), fields);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_file << line;
+		m_file.flush(); // line is complete for readers that tail the file
+	}
+
+	// number as JSON string
+	template<typename T>
+	static std::string Str(const T& value)
+	{
+		std::stringstream s;
+		s << '"' << value << '"';
+		return s.str();
+	}
+};
+
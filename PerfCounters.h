@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <format>
+
+// Hardware counters of one thread: cycles, instructions, branches, branch misses, L1 data, LLC and data TLB misses.
+// Compiled in only when USE_PERF_COUNTERS is defined (Linux perf_event_open), otherwise PerfCounters is an empty stub
+// and all instrumentation around the kernels is removed by preprocessor, so there is no cost at all.
+// At runtime counters are enabled by option --perf.
+struct PerfSample
+{
+	uint64_t cycles = 0;
+	uint64_t instructions = 0;
+	uint64_t branches = 0;
+	uint64_t branchMisses = 0;
+	uint64_t l1Misses = 0;  // L1 data cache read misses
+	uint64_t llcMisses = 0; // last level cache misses
+	uint64_t tlbMisses = 0; // data TLB read misses, random lookups into big cache without huge pages
+	// time when counters of the group were scheduled on CPU, ns. 0 - group was not counted, its values are meaningless
+	uint64_t coreTime = 0;  // cycles, instructions, branches
+	uint64_t memTime = 0;   // cache and TLB misses
+
+	PerfSample& operator+=(const PerfSample& b)
+	{
+		cycles += b.cycles;
+		instructions += b.instructions;
+		branches += b.branches;
+		branchMisses += b.branchMisses;
+		l1Misses += b.l1Misses;
+		llcMisses += b.llcMisses;
+		tlbMisses += b.tlbMisses;
+		coreTime += b.coreTime;
+		memTime += b.memTime;
+		return *this;
+	}
+
+	PerfSample operator-(const PerfSample& b) const
+	{
+		PerfSample r;
+		r.cycles = cycles - b.cycles;
+		r.instructions = instructions - b.instructions;
+		r.branches = branches - b.branches;
+		r.branchMisses = branchMisses - b.branchMisses;
+		r.l1Misses = l1Misses - b.l1Misses;
+		r.llcMisses = llcMisses - b.llcMisses;
+		r.tlbMisses = tlbMisses - b.tlbMisses;
+		r.coreTime = coreTime - b.coreTime;
+		r.memTime = memTime - b.memTime;
+		return r;
+	}
+
+	double Ipc() const { return cycles > 0 ? (double)instructions / cycles : 0; }
+	double BranchMissRate() const { return branches > 0 ? 100.0 * branchMisses / branches : 0; }
+
+	std::string ToString() const
+	{
+		std::string core = coreTime > 0 ? std::format("IPC: {:.2f} br-miss: {:.2f}%", Ipc(), BranchMissRate()) : "IPC, br-miss: not counted";
+		std::string mem = memTime > 0 ? std::format("L1-miss: {} LLC-miss: {} dTLB-miss: {}", l1Misses, llcMisses, tlbMisses) : "L1, LLC, dTLB-miss: not counted";
+		return core + ' ' + mem;
+	}
+};
+
+#if defined(USE_PERF_COUNTERS) && defined(__linux__)
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// counters of the thread that created the object. Counters that are not supported by CPU (or VM) read as 0.
+// CPU has only 4 general purpose counters per hyperthread, so events are split into two groups: all events of a group
+// are counted at the same time, and kernel multiplexes the groups if both do not fit
+class PerfCounters
+{
+private:
+	static const int COUNTERS = 7;
+	static const int GROUPS = 2;
+	static constexpr int GROUP_OF[COUNTERS] = { 0, 0, 0, 0, 1, 1, 1 }; // core events, cache and TLB events
+	int m_fd[COUNTERS];
+	int m_leader[GROUPS] = { -1, -1 }; // group leader is the first opened counter of the group
+	int m_opened[GROUPS] = { 0, 0 };
+	int m_slot[COUNTERS]; // position of counter in read buffer of its group, -1 if counter is not opened
+
+	static int open(uint32_t type, uint64_t config, int groupFd)
+	{
+		perf_event_attr attr{};
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = groupFd == -1 ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0); // this thread, any CPU
+	}
+
+public:
+	PerfCounters()
+	{
+		const uint64_t L1D_READ_MISS = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		const uint64_t DTLB_READ_MISS = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		const struct { uint32_t type; uint64_t config; } events[COUNTERS] = {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+			{ PERF_TYPE_HW_CACHE, L1D_READ_MISS },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+			{ PERF_TYPE_HW_CACHE, DTLB_READ_MISS },
+		};
+
+		for (int i = 0; i < COUNTERS; i++)
+		{
+			int g = GROUP_OF[i];
+			m_fd[i] = open(events[i].type, events[i].config, m_leader[g]);
+			m_slot[i] = m_fd[i] >= 0 ? m_opened[g]++ : -1;
+			if (m_leader[g] == -1 && m_fd[i] >= 0) m_leader[g] = m_fd[i];
+		}
+
+		for (int g = 0; g < GROUPS; g++)
+		{
+			if (m_leader[g] < 0) continue;
+			ioctl(m_leader[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(m_leader[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+
+	~PerfCounters()
+	{
+		for (int i = 0; i < COUNTERS; i++)
+			if (m_fd[i] >= 0) close(m_fd[i]);
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	bool IsOpen() const
+	{
+		return m_leader[0] >= 0 || m_leader[1] >= 0;
+	}
+
+	// current values of counters since creation. values are scaled if groups were multiplexed by kernel.
+	// group that was never scheduled has time 0 in the sample, it is reported as not counted
+	PerfSample Read() const
+	{
+		PerfSample s;
+		uint64_t value[COUNTERS] = {};
+		uint64_t running[GROUPS] = {};
+		for (int g = 0; g < GROUPS; g++)
+		{
+			if (m_leader[g] < 0) continue;
+
+			uint64_t buf[3 + COUNTERS]; // nr, time_enabled, time_running, values
+			if (::read(m_leader[g], buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t)) || buf[2] == 0) continue;
+
+			running[g] = buf[2];
+			double scale = (double)buf[1] / buf[2];
+			for (int i = 0; i < COUNTERS; i++)
+				if (GROUP_OF[i] == g && m_slot[i] >= 0) value[i] = (uint64_t)(buf[3 + m_slot[i]] * scale);
+		}
+
+		s.cycles = value[0];
+		s.instructions = value[1];
+		s.branches = value[2];
+		s.branchMisses = value[3];
+		s.l1Misses = value[4];
+		s.llcMisses = value[5];
+		s.tlbMisses = value[6];
+		s.coreTime = running[0];
+		s.memTime = running[1];
+		return s;
+	}
+};
+
+#else
+
+class PerfCounters
+{
+public:
+	bool IsOpen() const { return false; }
+	PerfSample Read() const { return PerfSample(); }
+};
+
+#endif
+
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+// Compact steps-only table of numbers 0..Size()-1 for early termination of trajectories (option --steps-table).
+// Steps are counted the same way as in ThreeN1::Calc3p1 (odd step (3x+1)/2 counts as 2 steps).
+// Steps of numbers below 2^64 are far below 65535, so uint16_t is enough and the table is 4 times smaller
+// than array of uint64_t: default 1M entries take 2 MB and fit into L2/L3 cache.
+class StepsTable
+{
+private:
+	std::vector<uint16_t> m_steps;
+
+public:
+	static const uint64_t SIZE_DEF = 1ull << 20;
+	static const uint64_t MAX_SIZE = 1ull << 32; // 8 GB table makes no sense, it does not fit into any cache
+
+	// calculates steps of numbers 0..size-1. each trajectory is stopped as soon as it falls below its start number,
+	// steps of the rest are already in the table, so building takes a few steps per number
+	void Init(uint64_t size)
+	{
+		if (size < 2 || size > MAX_SIZE)
+			throw std::invalid_argument("Error: size of steps table must be in range 2.." + std::to_string(MAX_SIZE) + ".\n");
+
+		m_steps.assign(size, 0);
+		for (uint64_t n = 2; n < size; n++)
+		{
+			uint64_t curr = n, steps = 0;
+			while (curr >= n)
+			{
+				if ((curr & 1ull) == 0)
+					curr >>= 1, steps++;
+				else
+					curr = (3ull * curr + 1ull) / 2, steps += 2;
+			}
+			m_steps[n] = (uint16_t)(steps + m_steps[curr]);
+		}
+	}
+
+	uint64_t Size() const
+	{
+		return m_steps.size();
+	}
+
+	uint64_t Get(uint64_t number) const
+	{
+		return m_steps[number];
+	}
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <format>
+
+// Chooses number of active worker threads by measured throughput (numbers/sec).
+// Starts with all threads active and steps down while throughput does not drop.
+// Hyperthreads and shared hosts often give the same or even better throughput with fewer threads,
+// so the smallest count within TOLERANCE from the best throughput wins.
+// Load of a shared host changes over a long calculation, so after REPROBE_SEC the tuner measures the chosen count again
+// and probes one step up (more threads must be faster by TOLERANCE), then one step down.
+// Parked threads finish their current sub-range first, so measurement starts only when such sub-ranges are drained:
+// otherwise samples would mix different counts of threads.
+class ThreadsTuner
+{
+private:
+	static constexpr double MEASURE_SEC = 10.0;  // length of one measurement
+	static constexpr double WARMUP_SEC = 2.0;    // time after change of threads count that is not measured
+	static constexpr double TOLERANCE = 0.02;    // throughput within 2% is considered the same
+	static constexpr double REPROBE_SEC = 600.0; // time between settle and the next probe
+
+	enum State { BASE, UP, DOWN, HOLD };
+
+	uint64_t m_max;
+	uint64_t m_step;
+	State m_state = BASE;
+	bool m_stopped = false;
+	bool m_climbed = false; // probe up gave better throughput, so probe down is not needed
+	uint64_t m_best = 0;
+	double m_bestSpeed = 0;
+
+	double m_warmup = WARMUP_SEC;
+	double m_seconds = 0;
+	uint64_t m_numbers = 0;
+	double m_holdSec = 0;
+
+	uint64_t settle(std::string& report)
+	{
+		m_state = HOLD;
+		m_holdSec = 0;
+		report += std::format(". Settled at {} threads", m_best);
+		return m_best;
+	}
+
+public:
+	ThreadsTuner(uint64_t maxThreads)
+	{
+		m_max = std::max<uint64_t>(1, maxThreads);
+		m_step = std::max<uint64_t>(1, maxThreads / 8);
+	}
+
+	bool Settled() const
+	{
+		return m_stopped || m_state == HOLD;
+	}
+
+	// stops tuning, active threads count is controlled manually from now
+	void Stop()
+	{
+		m_stopped = true;
+	}
+
+	// called periodically with number of numbers calculated during last 'seconds' by 'active' threads.
+	// draining is true while parked threads still calculate their sub-ranges.
+	// returns number of threads that should be active from now. report gets description of tuner decision if any.
+	uint64_t Update(uint64_t active, uint64_t numbers, double seconds, bool draining, std::string& report)
+	{
+		if (m_stopped) return active;
+
+		if (m_state == HOLD)
+		{
+			m_holdSec += seconds;
+			if (m_holdSec < REPROBE_SEC) return active;
+			m_state = BASE; // throughput of current count is measured again, it is the base for probes
+			m_climbed = false;
+			m_warmup = 0;
+		}
+
+		if (draining)
+		{
+			m_warmup = WARMUP_SEC; // warmup starts when the last parked thread has finished its sub-range
+			return active;
+		}
+
+		if (m_warmup > 0)
+		{
+			m_warmup -= seconds;
+			return active;
+		}
+
+		m_numbers += numbers;
+		m_seconds += seconds;
+		if (m_seconds < MEASURE_SEC) return active;
+
+		double speed = m_numbers / m_seconds;
+		m_numbers = 0;
+		m_seconds = 0;
+		m_warmup = WARMUP_SEC;
+
+		report = std::format("Threads: {} speed: {:.0f} num/sec ({:.0f} num/sec per thread)", active, speed, speed / active);
+
+		switch (m_state)
+		{
+		case BASE:
+			m_best = active;
+			m_bestSpeed = speed;
+			if (active < m_max)
+			{
+				m_state = UP;
+				return std::min(m_max, active + m_step);
+			}
+			m_state = DOWN;
+			if (active > 1) return active > m_step ? active - m_step : 1;
+			return settle(report);
+
+		case UP:
+			if (speed > m_bestSpeed * (1.0 + TOLERANCE)) // more threads do more work
+			{
+				m_best = active;
+				m_bestSpeed = speed;
+				m_climbed = true;
+				if (active < m_max) return std::min(m_max, active + m_step);
+				return settle(report);
+			}
+			if (m_climbed || m_best == 1) return settle(report);
+			m_state = DOWN;
+			return m_best > m_step ? m_best - m_step : 1;
+
+		case DOWN:
+			if (speed >= m_bestSpeed * (1.0 - TOLERANCE)) // fewer threads do the same work
+			{
+				m_best = active;
+				m_bestSpeed = std::max(m_bestSpeed, speed);
+				if (active > 1) return active > m_step ? active - m_step : 1;
+			}
+			return settle(report);
+
+		default:
+			return active;
+		}
+	}
+};
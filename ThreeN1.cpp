@@ -11,26 +11,39 @@ void ThreeN1<BigInt>::Calc3p1(const BigInt& number, ThreeN1Data<BigInt>& calcRes
     calcResult.maxvalue = number;
     calcResult.steps = 0ull;
     BigInt curr = number;
-    
-    if (curr < m_unused.BitsCount()) m_unused.setTrue(curr); //m_paths[curr] = true;
+    const bool trackUnused = m_unused.BitsCount() > 0;
+    const uint64_t unusedLimit = m_unused.BitsCount(); // compared with BigInt by length without temporary
 
-    while (curr != 1ull)
+    if (trackUnused && curr < unusedLimit) m_unused.setTrue(curr.to_u64()); //m_paths[curr] = true;
+
+    while (!curr.IsOne())
     {
+        if (Length(curr) <= DEMOTE_DIGITS) // the rest of trajectory is calculated with uint64_t
+        {
+            uint64_t native = curr.to_u64(), steps = calcResult.steps, maxvalue = 0;
+            bool finished = trackUnused ? calc3p1Native<true>(native, steps, maxvalue) : calc3p1Native<false>(native, steps, maxvalue);
+            calcResult.steps = (uint16_t)steps;
+            if (calcResult.maxvalue < maxvalue) calcResult.maxvalue = maxvalue;
+            if (finished) break;
+            curr = native; // native is too big for the next odd step, it is done by BigInt
+        }
+
         if (curr.IsEven())
         {
-            divide_by_2(curr);
+            // all halvings at once if every intermediate number does not have to be marked as used
+            unsigned int k = trackUnused ? 1 : count_trailing_even(curr);
+            halve(curr, k);
+            calcResult.steps += k;
         }
         else
         {
-            curr = (3ull * curr + 1ull) / 2; //TODO why dont use divide_by_2() here? 
+            mul3add1_half(curr);
 
-            calcResult.steps++; // if curr is odd we do 2 operations at once and increase steps twice accordingly
+            calcResult.steps += 2; // if curr is odd we do 2 operations at once and increase steps twice accordingly
             if (calcResult.maxvalue < curr) calcResult.maxvalue = curr;
         }
 
-        calcResult.steps++;
-
-        if (curr < m_unused.BitsCount()) m_unused.setTrue(curr); //m_paths[curr] = true;
+        if (trackUnused && curr < unusedLimit) m_unused.setTrue(curr.to_u64()); //m_paths[curr] = true;
     }
 }
 
@@ -58,7 +71,7 @@ void ThreeN1<uint64_t>::CacheToFileVarLen(const uint64_t& start, const std::stri
     f.write((const char*)buf, offset);  // saving expected number of items in a file
 
     offset = 0;
-    for (uint i = 0; i < m_valuesCache.Count(); ++i)
+    for (uint64_t i = 0; i < m_valuesCache.Count(); ++i)
     {
         CalcDataType val = m_valuesCache[i];
         assert(val.steps < 65536);
@@ -84,6 +97,7 @@ void ThreeN1<uint64_t>::CacheToFileVarLen(const uint64_t& start, const std::stri
 template<>
 void ThreeN1<uint64_t>::CacheFromFileVarLen(const std::string& fileName)
 {
+    PROFILE_ZONE("cache load");
     std::ifstream f;
     f.open(fileName, std::ios::out | std::ios::binary);
     if (f.fail())
@@ -103,7 +117,7 @@ void ThreeN1<uint64_t>::CacheFromFileVarLen(const std::string& fileName)
     res = var_len_decode(buf, maxSize, &cnt);
     assert(res > 0);
 
-    m_valuesCache.SetCapacity((uint)(cnt));// +2ull)); // +2 just in case
+    m_valuesCache.SetCapacity(cnt);
     CalcDataType val;
     while (true)
     {
@@ -133,6 +147,7 @@ void ThreeN1<uint64_t>::CacheFromFileVarLen(const std::string& fileName)
 template<>
 void ThreeN1<uint64_t>::CacheFromFileVarLen2(const std::string& fileName, int64_t itemsToRead)
 {
+    PROFILE_ZONE("cache load");
     std::ifstream f;
     f.open(fileName, std::ios::out | std::ios::binary);
     if (f.fail())
@@ -155,7 +170,7 @@ void ThreeN1<uint64_t>::CacheFromFileVarLen2(const std::string& fileName, int64_
     m_cacheFinish = m_cacheStart + cnt;
 
     m_valuesCache.Clear();
-    m_valuesCache.SetCapacity((uint)(toULongLong(cnt)));// +2ull)); // +2 just in case
+    m_valuesCache.SetCapacity(toULongLong(cnt));
     CalcDataType val;
     size_t offset = 0;
     size_t actualBufSize = BUF_LEN;
@@ -300,7 +315,7 @@ void calc3p1Range(BigInt start, BigInt finish)
     ull capacity = toULongLong(cap);
     values.SetCapacity((unsigned int)capacity);
 
-    for (BigInt i = start; i < finish; i++)
+    for (BigInt i = start; i < finish; ++i)
     {
         if (i.HasTrailingZeros(3)) // for optimization print every 1000th number only
             cout << '\r' << i << '\r';
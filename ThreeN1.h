@@ -3,8 +3,25 @@
 #include <string>
 #include <cassert>
 #include <fstream>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <csignal>
 
 #include "DynamicArrays.h"
+#include "BoundedQueue.h"
+#include "ThreadsTuner.h"
+#include "PerfCounters.h"
+#include "Metrics.h"
+#include "StepsTable.h"
+#include "ColumnarExport.h"
+#include "Histograms.h"
+#include "CompressedBitset.h"
+#include "HugeArray.h"
+#include "Ticks.h"
 #include "thread_pool.h"
 #include "ThreeN1Task.h"
 #include "Utils.h"
@@ -14,6 +31,9 @@
 template<typename IntImpl>
 class ThreeN1Task;
 
+template<typename IntImpl>
+class ThreeN1Context;
+
 #pragma pack(push, 1)
 template<typename IntImpl>
 struct ThreeN1Data
@@ -33,6 +53,7 @@ public:
 template<typename IntImpl>
 struct RangeData
 {
+	uint64_t index; // index of sub-range in threaded calculation
 	IntImpl start;
 	IntImpl finish;
 	IntImpl num1;
@@ -41,8 +62,67 @@ struct RangeData
 	IntImpl num2maxvalue;
 	IntImpl errnum;
 	enum ThreeN1Task<IntImpl>::TaskStatus status;
+	std::string error; // message of exception that stopped the sub-range, status is error
+#ifdef USE_PERF_COUNTERS
+	PerfSample perf; // hardware counters of sub-range calculation, filled if counters are enabled
+#endif
+};
+
+// Records of the whole range collected from results of sub-ranges
+template<typename IntImpl>
+struct RecordsData
+{
+	uint64_t maxsteps = 0;
+	IntImpl msnum = 0ull;    // number that generates maxsteps
+	IntImpl maxvalue = 0ull;
+	IntImpl mvnum = 0ull;    // number that generates maxvalue
+
+	static const int NEW_STEPS = 1;
+	static const int NEW_MAXVALUE = 2;
+
+	// returns combination of NEW_STEPS and NEW_MAXVALUE flags if sub-range has new records.
+	// sub-ranges come in any order, so on tie the smaller number wins: result does not depend on order of sub-ranges
+	int Update(const RangeData<IntImpl>& rd)
+	{
+		int res = 0;
+		if (maxsteps < rd.num1steps || (maxsteps == rd.num1steps && rd.num1 < msnum))
+			maxsteps = rd.num1steps, msnum = rd.num1, res |= NEW_STEPS;
+		if (maxvalue < rd.num2maxvalue || (maxvalue == rd.num2maxvalue && rd.num2 < mvnum))
+			maxvalue = rd.num2maxvalue, mvnum = rd.num2, res |= NEW_MAXVALUE;
+		return res;
+	}
+};
+
+// Descriptor of one sub-range calculated by a worker thread.
+// Numbers are counted from the base of whole range (ThreeN1::m_rangeBase) so descriptor is POD for any IntImpl
+struct RangeDescr
+{
+	uint64_t index;  // sequential number of sub-range
+	uint64_t offset; // first number of sub-range is m_rangeBase + offset
+	uint64_t count;  // amount of numbers in sub-range
 };
 
+// change of active threads count requested by signals (SIGUSR1 - one thread more, SIGUSR2 - one thread less).
+// lock-free atomic is safe to be modified in signal handler
+inline std::atomic<int> ThreadsDeltaRequested = 0;
+
+inline void ThreadsSignalHandler(int sig)
+{
+#ifdef SIGUSR1
+	ThreadsDeltaRequested.fetch_add(sig == SIGUSR1 ? 1 : -1, std::memory_order_relaxed);
+#endif
+}
+
+// converts decimal string into IntImpl
+template<typename IntImpl>
+IntImpl StrToInt(const std::string& str)
+{
+	if constexpr (std::is_same<IntImpl, BigInt>::value)
+		return BigInt(str.c_str());
+	else
+		return std::stoull(str);
+}
+
 template<typename U>
 std::ostream& operator<<(std::ostream& out, const struct ThreeN1Data<U>& d)
 {
@@ -108,11 +188,25 @@ class ThreeN1
 public:
 	using DataType = IntImpl;
 	using CalcDataType = ThreeN1Data<IntImpl>;
-	using CacheType = THArray<CalcDataType>;
+	using CacheType = HugeArray<CalcDataType>; // 64-bit indexes, huge pages
+	using RangeBatch = std::vector<RangeData<IntImpl>>;
 private:
+	friend class Bench; // benchmark calls kernels directly
+
 	bool checkInCache(const IntImpl& curr, const IntImpl& start, const IntImpl& finish, CalcDataType& calcResult);
 	void calc3p1Cache(const IntImpl& start, const IntImpl& finish, const IntImpl& number, CalcDataType& calcResult);
-	void rangeDataToFile(const std::string& fileName);
+	template<bool trackUnused>
+	bool calc3p1Native(uint64_t& curr, uint64_t& steps, uint64_t& maxvalue);
+	void writeRangeData(std::ostream& f, const RangeData<IntImpl>& data);
+	void reduceStage();
+	void writeStage(std::ofstream* f);
+	void writeCheckpoint(const RecordsData<IntImpl>& records, uint64_t resultsSize);
+	void syncResults();
+	void readCheckpoint();
+	void metricsProgress(uint64_t numbers, double numPerSec, double stepsPerSec, const std::string& threadSpeeds, double etaSec);
+	void metricsRecord(const char* kind, const IntImpl& number, const std::string& value);
+	void histReport(std::ostream& out, const IntImpl& start, const IntImpl& finish, const std::string& fileName);
+	void unusedReport(std::ostream& out);
 
 public:
 	THArraySorted<RangeData<IntImpl>> m_rangeData;
@@ -122,13 +216,89 @@ public:
 
 	uint64_t m_hits = 0;
 	std::mutex m_cacheMutex;
+
+	// BigInt kernels continue trajectory with uint64_t when current number has not more than DEMOTE_DIGITS digits.
+	// 10^18 is less than 2^64/3, so native odd step cannot overflow right after demotion
+	static const int DEMOTE_DIGITS = 18;
 	//const uint64_t PATHS_SIZE = 1'000'000'000ull;
 	//bool* m_paths;
-	MyBitset m_unused; // false in this array means that cpecified number is unused, true - is used.
+	CompressedBitset m_unused; // false in this array means that cpecified number is unused, true - is used. compressed by chunks, so -u may be 10^12 and more
+
+	// state of threaded calculation, see Calc3p1allThreads
+	static const uint64_t ONE_TASK_RANGE_DEF = 10'000'000ull;
+	static const uint64_t PRINT_TASK_RANGE_MIN = 1'000'000ull; // sub-ranges smaller than this are not printed one by one
+	uint64_t m_taskRange = ONE_TASK_RANGE_DEF; // size of one sub-range
+	IntImpl m_rangeBase;        // start of whole range
+	uint64_t m_rangeWidth = 0;  // number of numbers in whole range
+	uint64_t m_rangesTotal = 0; // number of sub-ranges in whole range
+	bool m_printRanges = true;  // print results of each sub-range
+	std::atomic<uint64_t> m_nextRange = 0; // index of next sub-range to be taken by worker thread
+	std::atomic<uint64_t> m_rangesDone = 0;
+	std::vector<std::unique_ptr<ThreeN1Context<IntImpl>>> m_contexts; // one context per worker thread, nullptr till the thread is activated
+
+	// pool has a thread for each context, but only first m_activeThreads workers take sub-ranges, others are parked.
+	// count of active workers can be changed during calculation by ThreadsTuner (auto mode) or by signals
+	static const uint64_t THREADS_AUTO = 0;
+	std::atomic<uint64_t> m_activeThreads = 0;
+	bool m_allTaken = false; // all sub-ranges are taken, parked workers exit
+	std::mutex m_activeMutex;
+	std::condition_variable m_activeCv;
+	std::condition_variable m_doneCv; // notified when the last sub-range is done
+
+	// pipeline of threaded calculation: compute workers -> reducer -> writer
+	static const size_t PIPELINE_QUEUE_SIZE = 64; // max number of batches waiting in each queue
+	uint64_t m_batchSize = 1;   // number of sub-ranges collected by worker before handing them to reducer
+	BoundedQueue<RangeBatch> m_reduceQueue{ PIPELINE_QUEUE_SIZE };
+	BoundedQueue<RangeBatch> m_writeQueue{ PIPELINE_QUEUE_SIZE };
+	std::string m_resultsFile;  // file for results of sub-ranges, results are not saved if empty
+
+	RecordsData<IntImpl> m_records; // records of whole range, updated by reducer stage only
+	// copy of m_records for workers of records-only calculation, they skip numbers that do not beat these records
+	RecordsData<IntImpl> m_known;
+	std::mutex m_knownMutex;
+
+	// checkpoints of threaded calculation, written by writer stage
+	static const uint64_t CHECKPOINT_INTERVAL_DEF = 600; // seconds
+	static constexpr const char* CHECKPOINT_SIGNATURE = "3N1CHECKPOINT2";
+	std::string m_checkpointFile;    // checkpoints are not written if empty
+	uint64_t m_checkpointInterval = CHECKPOINT_INTERVAL_DEF;
+	bool m_resume = false;           // skip sub-ranges completed according to checkpoint file
+	MyBitset m_resumedRanges;        // sub-ranges completed before resume, read only during calculation
+	MyBitset m_persistedRanges;      // sub-ranges persisted by writer stage, used by writer only
+	RecordsData<IntImpl> m_resumedRecords; // records loaded from checkpoint
+	uint64_t m_resumedResultsSize = 0;     // size of results file at the moment of checkpoint
+	uint64_t m_checkpointsCnt = 0;
+	uint64_t m_checkpointsTime = 0;  // total time spent for writing checkpoints, ms
+
+	MetricsWriter m_metrics; // JSON lines metrics stream, see Metrics.h
+
+	bool m_perf = false; // collect hardware counters per sub-range and per kernel, works if USE_PERF_COUNTERS is defined
+
+	// record-only scan: kernel calculates steps and max value only, unused numbers are not tracked,
+	// total steps are not counted and progress is accounted per block of numbers instead of per number
+	bool m_recordsOnly = false;
+
+	// steps of small numbers for early termination in record-only scan (option --steps-table).
+	// if table is not empty, only records of steps are searched: max value cannot be known when trajectory is cut
+	StepsTable m_stepsTable;
+
+	// distribution of steps and max values of calculated numbers, collected by all kernels except record-only scan
+	Histograms m_hist;
+	std::string m_histFile; // histograms are saved into this file, by default next to results file of threaded calculation
+
+	// all unused numbers are exported into this file after calculation of range (option --unused-out)
+	std::string m_unusedFile;
+
+	// steps and max value of every number are exported into this file by threaded calculation (option --columns-out)
+	std::string m_columnsFile;
+	ColumnarExport m_columns;
 
 	void Calc3p1(const IntImpl& number, CalcDataType& calcResult);
+	void Calc3p1Fast(const IntImpl& number, CalcDataType& calcResult);
+	uint64_t Calc3p1Steps(const IntImpl& number);
 	void Calc3p1Range(const IntImpl& start, const IntImpl& finish);
 	void Calc3p1RangeCache(const IntImpl& start, const IntImpl& finish);
+	void Calc3p1RangeFast(const IntImpl& start, const IntImpl& finish);
 
 	void Calc3p1allThreads(const IntImpl& start, const IntImpl& finish, uint64_t threadsCnt);
 	void CacheToFileVarLen(const IntImpl& start, const std::string& fileName);
@@ -136,8 +306,10 @@ public:
 	void CacheFromFileVarLen(const std::string& fileName);
 	void CacheFromFileVarLen2(const std::string& fileName, int64_t itemsToRead = -1);
 	void CacheFromFileBin(const std::string& fileName);
+	void rangeDataToFile(const std::string& fileName);
+	bool readRangeData(std::istream& f, RangeData<IntImpl>& data);
 
-	void addRangeData(RangeData<IntImpl> data)
+	void addRangeData(const RangeData<IntImpl>& data)
 	{
 		std::lock_guard<std::mutex> lock(m_cacheMutex);
 		m_rangeData.AddValue(data);
@@ -147,6 +319,119 @@ public:
 	{
 		m_unused.Init(value);
 	}
+
+	void SaveResultsTo(const std::string& fileName)
+	{
+		m_resultsFile = fileName;
+	}
+
+	// checkpoints are written into fileName each intervalSec seconds
+	void SetCheckpoint(const std::string& fileName, uint64_t intervalSec, bool resume)
+	{
+		m_checkpointFile = fileName;
+		m_checkpointInterval = intervalSec;
+		m_resume = resume;
+	}
+
+	void SetMetricsOut(const std::string& fileName)
+	{
+		m_metrics.Open(fileName);
+	}
+
+	void SetRecordsOnly(bool value)
+	{
+		m_recordsOnly = value;
+	}
+
+	void SetHistOut(const std::string& fileName)
+	{
+		m_histFile = fileName;
+	}
+
+	void SetUnusedOut(const std::string& fileName)
+	{
+		m_unusedFile = fileName;
+	}
+
+	void SetColumnsOut(const std::string& fileName)
+	{
+		m_columnsFile = fileName;
+	}
+
+	void SetStepsTable(uint64_t size)
+	{
+		m_stepsTable.Init(size);
+	}
+
+	// returns false if counters are not compiled in or cannot be opened (see /proc/sys/kernel/perf_event_paranoid)
+	bool EnablePerfCounters(bool enable)
+	{
+		m_perf = enable && PerfCounters().IsOpen();
+		return m_perf;
+	}
+
+	void SetTaskRange(uint64_t value)
+	{
+		if (value == 0)
+			throw std::invalid_argument("Error: size of sub-range cannot be zero.\n");
+		m_taskRange = value;
+	}
+
+	void SetActiveThreads(uint64_t cnt)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_activeMutex);
+			m_activeThreads = std::clamp<uint64_t>(cnt, 1, m_contexts.size());
+			for (uint64_t j = 0; j < m_activeThreads; j++) // worker takes its context after WaitActive, i.e. under the same mutex
+				if (!m_contexts[j]) m_contexts[j] = std::make_unique<ThreeN1Context<IntImpl>>(j);
+		}
+		m_activeCv.notify_all();
+	}
+
+	// called by worker before it takes next sub-range. parks worker with index >= m_activeThreads
+	// returns false if worker should exit
+	bool WaitActive(uint64_t index)
+	{
+		if (index < m_activeThreads.load(std::memory_order_acquire)) return true; // acquire: context of the worker is created before it is activated
+
+		std::unique_lock<std::mutex> lock(m_activeMutex);
+		m_activeCv.wait(lock, [&] { return m_allTaken || index < m_activeThreads; });
+		return index < m_activeThreads;
+	}
+
+	// called by worker when sub-range is done
+	void RangeDone()
+	{
+		if (m_rangesDone.fetch_add(1, std::memory_order_release) + 1 == m_rangesTotal)
+		{
+			std::lock_guard<std::mutex> lock(m_activeMutex);
+			m_doneCv.notify_all();
+		}
+	}
+
+	// records of whole range reduced so far, called by worker threads
+	void KnownRecords(RecordsData<IntImpl>& records)
+	{
+		std::lock_guard<std::mutex> lock(m_knownMutex);
+		records = m_known;
+	}
+
+	// takes next sub-range for calculation, called by worker threads
+	// returns false when all sub-ranges are already taken
+	bool NextRange(RangeDescr& descr)
+	{
+		uint64_t index;
+		do
+		{
+			index = m_nextRange.fetch_add(1, std::memory_order_relaxed);
+			if (index >= m_rangesTotal) return false;
+		} while (m_resume && m_resumedRanges.get(index)); // skip sub-ranges completed before resume
+
+		descr.index = index;
+		descr.offset = index * m_taskRange;
+		descr.count = std::min(m_taskRange, m_rangeWidth - descr.offset);
+		return true;
+	}
 };
 
 // calc ONE number WITHOUT using cache
@@ -163,16 +448,15 @@ void ThreeN1<IntImpl>::Calc3p1(const IntImpl& number, CalcDataType& calcResult)
 	const IntImpl OVERFLOW_LIMIT = std::numeric_limits<IntImpl>::max() / 3;
 	if constexpr (std::is_same<IntImpl, BigInt>::value) // for BigInt only
 	{
-		while (curr != 1ull)
+		while (!curr.IsOne())
 		{
 			if (curr.IsEven() )
 			{
-				divide_by_2(curr);
+				halve(curr);
 			}
 			else
 			{
-				curr = (curr + curr + curr + 1ull);
-				divide_by_2(curr);
+				mul3add1_half(curr);
 
 				calcResult.steps++; // if curr is odd we do 2 operations at once and increase steps twice accordingly
 				if (calcResult.maxvalue < curr) calcResult.maxvalue = curr;
@@ -210,6 +494,169 @@ void ThreeN1<IntImpl>::Calc3p1(const IntImpl& number, CalcDataType& calcResult)
 	}
 }
 
+// calc ONE number for record-only scan: steps and max value only, no tracking of unused numbers
+template<typename IntImpl>
+void ThreeN1<IntImpl>::Calc3p1Fast(const IntImpl& number, CalcDataType& calcResult)
+{
+	calcResult.maxvalue = number;
+	calcResult.steps = 0ull;
+	IntImpl curr = number;
+
+	if constexpr (std::is_same<IntImpl, BigInt>::value) // for BigInt only
+	{
+		while (!curr.IsOne())
+		{
+			if (Length(curr) <= DEMOTE_DIGITS) // the rest of trajectory is calculated with uint64_t
+			{
+				uint64_t native = curr.to_u64(), steps = calcResult.steps, maxvalue = 0;
+				bool finished = calc3p1Native<false>(native, steps, maxvalue);
+				calcResult.steps = (uint16_t)steps;
+				if (calcResult.maxvalue < maxvalue) calcResult.maxvalue = maxvalue;
+				if (finished) break;
+				curr = native; // native is too big for the next odd step, it is done by BigInt
+			}
+
+			if (curr.IsEven())
+			{
+				unsigned int k = count_trailing_even(curr); // all halvings at once
+				halve(curr, k);
+				calcResult.steps += k;
+			}
+			else
+			{
+				mul3add1_half(curr);
+				calcResult.steps += 2; // odd step is done together with the next even one
+
+				if (calcResult.maxvalue < curr) calcResult.maxvalue = curr;
+			}
+		}
+	}
+	else
+	{
+		static_assert(std::is_same<IntImpl, uint64_t>::value); // supported types only uint64_t and BigInt now
+
+		const IntImpl OVERFLOW_LIMIT = std::numeric_limits<IntImpl>::max() / 3;
+		while (curr != 1ull)
+		{
+			if ((curr & 1ull) == 0) // is even
+			{
+				curr >>= 1;
+				calcResult.steps++;
+			}
+			else
+			{
+				if (curr >= OVERFLOW_LIMIT)
+					throw std::overflow_error("Overflow detected!");
+
+				curr = (3ull * curr + 1ull) / 2;
+				calcResult.steps += 2; // odd step is done together with the next even one
+
+				if (calcResult.maxvalue < curr) calcResult.maxvalue = curr;
+			}
+		}
+	}
+}
+
+// continues trajectory of BigInt kernel with uint64_t (demotion), curr must be less than 2^64/3.
+// returns true when trajectory reaches 1. returns false if curr became too big for the next odd step,
+// then BigInt kernel continues from curr. max of numbers reached here is returned in maxvalue
+template<typename IntImpl>
+template<bool trackUnused>
+bool ThreeN1<IntImpl>::calc3p1Native(uint64_t& curr, uint64_t& steps, uint64_t& maxvalue)
+{
+	const uint64_t OVERFLOW_LIMIT = std::numeric_limits<uint64_t>::max() / 3;
+	while (curr != 1ull)
+	{
+		if ((curr & 1ull) == 0) // is even
+		{
+			curr >>= 1;
+			steps++;
+		}
+		else
+		{
+			if (curr >= OVERFLOW_LIMIT)
+				return false;
+
+			curr = (3ull * curr + 1ull) / 2;
+			steps += 2; // odd step is done together with the next even one
+			if (maxvalue < curr) maxvalue = curr;
+		}
+
+		if constexpr (trackUnused)
+			if (curr < m_unused.BitsCount()) m_unused.setTrue(curr);
+	}
+	return true;
+}
+
+// calc steps of ONE number for record-only scan of steps: trajectory is stopped as soon as it falls into steps table,
+// for most numbers it happens after a few steps
+template<typename IntImpl>
+uint64_t ThreeN1<IntImpl>::Calc3p1Steps(const IntImpl& number)
+{
+	uint64_t steps = 0;
+	IntImpl curr = number;
+
+	if constexpr (std::is_same<IntImpl, BigInt>::value) // for BigInt only
+	{
+		const uint64_t tableSize = m_stepsTable.Size();
+		const uint64_t OVERFLOW_LIMIT = std::numeric_limits<uint64_t>::max() / 3;
+		while (!(curr < tableSize))
+		{
+			if (Length(curr) <= DEMOTE_DIGITS) // the rest of trajectory is calculated with uint64_t
+			{
+				uint64_t native = curr.to_u64();
+				while (native >= m_stepsTable.Size() && ((native & 1ull) == 0 || native < OVERFLOW_LIMIT))
+				{
+					if ((native & 1ull) == 0)
+						native >>= 1, steps++;
+					else
+						native = (3ull * native + 1ull) / 2, steps += 2;
+				}
+				if (native < m_stepsTable.Size())
+					return steps + m_stepsTable.Get(native);
+				curr = native; // too big for the next odd step, it is done by BigInt
+			}
+
+			if (curr.IsEven())
+			{
+				unsigned int k = count_trailing_even(curr); // all halvings at once, result is in the table anyway if it falls below its size
+				halve(curr, k);
+				steps += k;
+			}
+			else
+			{
+				mul3add1_half(curr);
+				steps += 2;
+			}
+		}
+		return steps + m_stepsTable.Get(curr.to_u64());
+	}
+	else
+	{
+		static_assert(std::is_same<IntImpl, uint64_t>::value); // supported types only uint64_t and BigInt now
+
+		const IntImpl OVERFLOW_LIMIT = std::numeric_limits<IntImpl>::max() / 3;
+		const uint64_t tableSize = m_stepsTable.Size();
+		while (curr >= tableSize)
+		{
+			if ((curr & 1ull) == 0) // is even
+			{
+				curr >>= 1;
+				steps++;
+			}
+			else
+			{
+				if (curr >= OVERFLOW_LIMIT)
+					throw std::overflow_error("Overflow detected!");
+
+				curr = (3ull * curr + 1ull) / 2;
+				steps += 2;
+			}
+		}
+		return steps + m_stepsTable.Get(curr);
+	}
+}
+
 // Declaration of BigInt specialization of template method
 // Implementation should be in .cpp file
 // calcs ONE number WITHOUT using cache
@@ -232,16 +679,15 @@ void ThreeN1<IntImpl>::calc3p1Cache(const IntImpl& start, const IntImpl& finish,
 
 	if constexpr (std::is_same<IntImpl, BigInt>::value)
 	{
-		while (curr != 1ull)
+		while (!curr.IsOne())
 		{
 			if (curr.IsEven())
 			{
-				divide_by_2(curr);
+				halve(curr);
 			}
 			else
 			{
-				curr = (curr + curr + curr + 1ull);
-				divide_by_2(curr);
+				mul3add1_half(curr);
 				calcResult.steps++; // if curr is odd we do 2 operations at once and increase steps twice accordingly
 				if (calcResult.maxvalue < curr) calcResult.maxvalue = curr;
 			}
@@ -293,7 +739,7 @@ bool ThreeN1<IntImpl>::checkInCache(const IntImpl& curr, const IntImpl& start, c
 {
 	if (curr >= m_cacheStart && curr < m_cacheFinish)
 	{
-		CalcDataType& elem = m_valuesCache[(uint)toULongLong(curr - m_cacheStart)]; //TODO prefomance degradation here!!!
+		CalcDataType& elem = m_valuesCache[toULongLong(curr - m_cacheStart)];
 		if (elem.steps == 0) // we didn't meet this number earlier
 		{
 			CalcDataType calcRes2;
@@ -321,9 +767,10 @@ bool ThreeN1<IntImpl>::checkInCache(const IntImpl& curr, const IntImpl& start, c
 template<typename IntImpl>
 void ThreeN1<IntImpl>::Calc3p1Range(const IntImpl& start, const IntImpl& finish)
 {
-	uint64_t maxsteps = 0, sumsteps = 0, lineCnt = 0;
-	IntImpl num1 = 0ull;
-	IntImpl num2 = 0ull, maxmaxv = 0ull;
+	PROFILE_ZONE("range compute");
+	uint64_t maxsteps = 0, sumsteps = 0, lineCnt = 0, prevSteps = 0;
+	uint64_t num1 = 0, num2 = 0; // offsets of numbers with records of max value and steps from start
+	IntImpl maxmaxv = 0ull;
 	CalcDataType calcData{ 0ull, 0ull };
 	std::locale loc(std::cout.getloc(), new MyGroupSeparator());
 
@@ -332,35 +779,66 @@ void ThreeN1<IntImpl>::Calc3p1Range(const IntImpl& start, const IntImpl& finish)
 	auto start0 = std::chrono::high_resolution_clock::now();
 	auto start1 = start0;
 	std::chrono::high_resolution_clock::time_point stop;
+#ifdef USE_PERF_COUNTERS
+	std::unique_ptr<PerfCounters> perf;
+	PerfSample perf0, perf1;
+	if (m_perf) perf = std::make_unique<PerfCounters>(), perf0 = perf1 = perf->Read();
+#endif
+	m_hist.Clear();
 
-	for (IntImpl i = start; i < finish; i++)
+	const uint64_t count = toULongLong(finish - start);
+	IntImpl i = start;
+	for (uint64_t offset = 0; offset < count; ++offset, ++i)
 	{
 		if (--printCounter == 0) // show progress
 		{
 			printCounter = PRINT_VALUE;
 			stop = std::chrono::high_resolution_clock::now();
-			auto speed = PRINT_VALUE * 1000 / std::chrono::duration_cast<std::chrono::milliseconds>(stop - start1).count();
-			std::cout << '\r' << i+1 << " (speed: " << speed <<" num/sec) " << '\r'; // i+1 is to avoid showing ... 999 999 in progress print
+			auto ms = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(stop - start1).count());
+			auto speed = PRINT_VALUE * 1000 / ms;
+			if (m_metrics.IsOpen()) // one thread, so thread speed is the same as total
+			{
+				double sec = std::chrono::duration<double>(stop - start1).count();
+				double stepsSpeed = (sumsteps - prevSteps) / sec;
+				prevSteps = sumsteps;
+				uint64_t done = offset;
+				double avg = done / std::chrono::duration<double>(stop - start0).count();
+				metricsProgress(done, (double)speed, stepsSpeed, std::format("{}", speed), avg > 0 ? ((count - offset) / avg) : -1);
+			}
+
+			std::cout << '\r' << i+1 << " (speed: " << speed <<" num/sec) "; // i+1 is to avoid showing ... 999 999 in progress print
+#ifdef USE_PERF_COUNTERS
+			if (perf)
+			{
+				PerfSample p = perf->Read();
+				std::cout << (p - perf1).ToString() << ' ';
+				perf1 = p;
+			}
+#endif
+			std::cout << '\r';
 			start1 = std::chrono::high_resolution_clock::now();
 		}
 
 		Calc3p1(i, calcData);
 
 		sumsteps += calcData.steps;
+		m_hist.Add(calcData.steps, IntLog2(calcData.maxvalue));
 
 		if (maxmaxv < calcData.maxvalue)
 		{
-			num1 = i;
+			num1 = offset;
 			maxmaxv = calcData.maxvalue;
 			std::cout << std::format("[{:3}] Number: {:>25} | steps: {:>5L} | MAX VALUE: {:>25}", lineCnt++, i, calcData.steps, calcData.maxvalue) << std::endl;
+			metricsRecord("maxvalue", i, MetricsWriter::Str(calcData.maxvalue));
 			//std::cout << "number:" << i << "  steps:" << calcData.steps << "  MAX VALUE:" << calcData.maxvalue << std::endl;
 		}
 
 		if (maxsteps < calcData.steps)
 		{
-			num2 = i;
+			num2 = offset;
 			maxsteps = calcData.steps;
 			std::cout << std::format(loc, "[{:3}] Number: {:>25} | STEPS: {:>5L} | max value: {:>25}", lineCnt++, i, calcData.steps, calcData.maxvalue) << std::endl;
+			metricsRecord("steps", i, std::to_string(calcData.steps));
 			//std::cout << "number:" << i << "  STEPS:" << calcData.steps << "  max value:" << calcData.maxvalue << std::endl;
 		}
 	}
@@ -369,41 +847,28 @@ void ThreeN1<IntImpl>::Calc3p1Range(const IntImpl& start, const IntImpl& finish)
 
 	std::cout << "                                             \r" << std::endl; // clear progress counter
 
-	auto calcTime = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start0).count();
+	auto calcTime = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(stop - start0).count());
 	std::cout << "Total Steps: " << sumsteps << std::endl;
-	std::cout << "Average Steps: " << sumsteps / (finish - start) << std::endl;
-	std::cout << "Average Speed: " << (finish - start) * 1000 / calcTime << " num/sec" << std::endl;
+	std::cout << "Average Steps: " << sumsteps / count << std::endl;
+	std::cout << "Average Speed: " << count * 1000 / calcTime << " num/sec" << std::endl;
+#ifdef USE_PERF_COUNTERS
+	if (perf) std::cout << "Hardware counters: " << (perf->Read() - perf0).ToString() << std::endl;
+#endif
 	std::cout << "Calculation time: " << MillisecToStr(calcTime) << std::endl;
+	histReport(std::cout, start, finish, m_histFile);
 
-	auto num = std::max(num1, num2);
+	IntImpl msnum = RangeNumber(start, num2), mvnum = RangeNumber(start, num1);
+	auto num = std::max(msnum, mvnum);
 	uint64_t dig;
 	if constexpr (std::is_same<IntImpl, BigInt>::value) // for BigInt only
 		dig = (uint64_t)(Length(num) * 1.35);
 	else
 		dig = (uint64_t)((log10(num) + 1)*1.35); // +30% for spaces between groups by 3 digits 
 	
-	std::cout << std::format(loc, "Number: {:>{}} | max steps: {}", num2, dig, maxsteps) << std::endl;
-	std::cout << std::format(loc, "Number: {:>{}} | max value: {}", num1, dig, maxmaxv) << std::endl;
+	std::cout << std::format(loc, "Number: {:>{}} | max steps: {}", msnum, dig, maxsteps) << std::endl;
+	std::cout << std::format(loc, "Number: {:>{}} | max value: {}", mvnum, dig, maxmaxv) << std::endl;
 	
-	const uint SHOW_FIRST_UNUSED = 30;
-	uint unused = 0;
-	uint numOfFirst = SHOW_FIRST_UNUSED;
-	std::string str;
-	for (size_t i = 1; i < m_unused.BitsCount(); i++) // bypass 0 number, it is never touched 
-	{
-		if (m_unused.get(i) == false)
-		{
-			if (numOfFirst > 0)
-			{
-				str = str + "," + std::to_string(i);
-				numOfFirst--;
-			}
-			unused++;
-		}
-	}
-
-	std::cout << "Unused numbers total: " << unused << std::endl;
-	std::cout << "Unused numbers (first " << SHOW_FIRST_UNUSED << "): " << str << std::endl;
+	unusedReport(std::cout);
 	//if (std::is_same<IntImpl, uint64_t>::value)
 	std::cout << "MAXULONGLONG: " << std::numeric_limits<IntImpl>::max()/* ULLONG_MAX*/ << std::endl;
 }
@@ -413,9 +878,10 @@ void ThreeN1<IntImpl>::Calc3p1Range(const IntImpl& start, const IntImpl& finish)
 template<typename IntImpl>
 void ThreeN1<IntImpl>::Calc3p1RangeCache(const IntImpl& start, const IntImpl& finish)
 {
-	uint64_t maxsteps = 0, sumsteps = 0, lineCnt = 0;
-	IntImpl num1 = 0ull;
-	IntImpl num2 = 0ull, maxmaxv = 0ull;
+	PROFILE_ZONE("range compute");
+	uint64_t maxsteps = 0, sumsteps = 0, lineCnt = 0, prevSteps = 0;
+	uint64_t num1 = 0, num2 = 0; // offsets of numbers with records of max value and steps from start
+	IntImpl maxmaxv = 0ull;
 	CalcDataType calcData{ 0ull, 0ull };
 
 	m_hits = 0;
@@ -434,15 +900,43 @@ void ThreeN1<IntImpl>::Calc3p1RangeCache(const IntImpl& start, const IntImpl& fi
 	auto start0 = std::chrono::high_resolution_clock::now();
 	auto start1 = start0; 
 	std::chrono::high_resolution_clock::time_point stop;
+#ifdef USE_PERF_COUNTERS
+	std::unique_ptr<PerfCounters> perf;
+	PerfSample perf0, perf1;
+	if (m_perf) perf = std::make_unique<PerfCounters>(), perf0 = perf1 = perf->Read();
+#endif
+	m_hist.Clear();
 
-	for (IntImpl i = start; i < finish; i++)
+	const uint64_t count = toULongLong(finish - start);
+	IntImpl i = start;
+	for (uint64_t offset = 0; offset < count; ++offset, ++i)
 	{
 		if (--printCounter == 0)
 		{
 			printCounter = PRINT_VALUE;
 			stop = std::chrono::high_resolution_clock::now();
-			auto speed = PRINT_VALUE * 1000 / std::chrono::duration_cast<std::chrono::milliseconds>(stop - start1).count();
-			std::cout << '\r' << i + 1 << " (speed: " << speed << " num/sec) " << '\r'; // i+1 is to avoid showing ... 999 999 in progress print
+			auto ms = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(stop - start1).count());
+			auto speed = PRINT_VALUE * 1000 / ms;
+			if (m_metrics.IsOpen()) // one thread, so thread speed is the same as total
+			{
+				double sec = std::chrono::duration<double>(stop - start1).count();
+				double stepsSpeed = (sumsteps - prevSteps) / sec;
+				prevSteps = sumsteps;
+				uint64_t done = offset;
+				double avg = done / std::chrono::duration<double>(stop - start0).count();
+				metricsProgress(done, (double)speed, stepsSpeed, std::format("{}", speed), avg > 0 ? ((count - offset) / avg) : -1);
+			}
+
+			std::cout << '\r' << i + 1 << " (speed: " << speed << " num/sec) "; // i+1 is to avoid showing ... 999 999 in progress print
+#ifdef USE_PERF_COUNTERS
+			if (perf)
+			{
+				PerfSample p = perf->Read();
+				std::cout << (p - perf1).ToString() << ' ';
+				perf1 = p;
+			}
+#endif
+			std::cout << '\r';
 			start1 = std::chrono::high_resolution_clock::now();
 		}
 
@@ -450,33 +944,43 @@ void ThreeN1<IntImpl>::Calc3p1RangeCache(const IntImpl& start, const IntImpl& fi
 		//m_valuesCache.SetValue((uint)(i - m_cacheStart), calcData); // works quicker than .AddValue()
 		
 		sumsteps += calcData.steps;
+		m_hist.Add(calcData.steps, IntLog2(calcData.maxvalue));
 
 		if (maxmaxv < calcData.maxvalue)
 		{
-			num1 = i;
+			num1 = offset;
 			maxmaxv = calcData.maxvalue;
 			std::cout << std::format(loc, "[{:3}] Number: {:>25} Steps: {:>5L} MAX VALUE: {:>25}", lineCnt++, i, calcData.steps, calcData.maxvalue) << std::endl;
+			metricsRecord("maxvalue", i, MetricsWriter::Str(calcData.maxvalue));
 			//std::cout << "number:" << i << "  steps:" << calcData.steps << "  MAX VALUE:" << calcData.maxvalue << std::endl;
 		}
 
 		if (maxsteps < calcData.steps)
 		{
-			num2 = i;
+			num2 = offset;
 			maxsteps = calcData.steps;
 			std::cout << std::format(loc, "[{:3}] Number: {:>25} STEPS: {:>5L} Max value: {:>25}", lineCnt++, i, calcData.steps, calcData.maxvalue) << std::endl;
+			metricsRecord("steps", i, std::to_string(calcData.steps));
 			//std::cout << "number:" << i << "  STEPS:" << calcData.steps << "  max value:" << calcData.maxvalue << std::endl;
 		}
 	}
 
+	stop = std::chrono::high_resolution_clock::now();
+
 	std::cout << "                                             \r" << std::endl; // clear progress counter
 
-	auto calcTime = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start0).count();
+	auto calcTime = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(stop - start0).count());
 	std::cout << "Total Steps: " << sumsteps << std::endl;
-	std::cout << "Average Steps: " << sumsteps / (finish - start) << std::endl;
-	std::cout << "Average Speed: " << (finish - start) * 1000 / calcTime << " num/sec" << std::endl;
+	std::cout << "Average Steps: " << sumsteps / count << std::endl;
+	std::cout << "Average Speed: " << count * 1000 / calcTime << " num/sec" << std::endl;
+#ifdef USE_PERF_COUNTERS
+	if (perf) std::cout << "Hardware counters: " << (perf->Read() - perf0).ToString() << std::endl;
+#endif
 	std::cout << "Calculation time: " << MillisecToStr(calcTime) << std::endl;
+	histReport(std::cout, start, finish, m_histFile);
 
-	auto num = std::max(num1, num2);
+	IntImpl msnum = RangeNumber(start, num2), mvnum = RangeNumber(start, num1);
+	auto num = std::max(msnum, mvnum);
 
 	uint64_t dig;
 	if constexpr (std::is_same<IntImpl, BigInt>::value) // for BigInt only
@@ -484,39 +988,135 @@ void ThreeN1<IntImpl>::Calc3p1RangeCache(const IntImpl& start, const IntImpl& fi
 	else
 		dig = (uint64_t)((log10(num) + 1) * 1.35); // +30% for spaces between groups by 3 digits 
 	
-	std::cout << std::format(loc, "Number: {:>{}L} | max steps: {}", toULongLong(num2), dig, maxsteps) << std::endl;
-	std::cout << std::format(loc, "Number: {:>{}L} | max value: {}", toULongLong(num1), dig, maxmaxv) << std::endl;
+	std::cout << std::format(loc, "Number: {:>{}L} | max steps: {}", toULongLong(msnum), dig, maxsteps) << std::endl;
+	std::cout << std::format(loc, "Number: {:>{}L} | max value: {}", toULongLong(mvnum), dig, maxmaxv) << std::endl;
 
-	const uint SHOW_FIRST_UNUSED = 30;
-	uint unused = 0;
-	uint numOfFirst = SHOW_FIRST_UNUSED;
-	//uint numOfFirstBy3 = 10;
-	std::string str;
-	for (size_t i = 1; i < m_unused.BitsCount(); i++) // bypass 0 number, it is never touched 
+	unusedReport(std::cout);
+	std::cout << "Cache size: " << m_valuesCache.Count() << std::endl;
+	std::cout << "Cache Hits: " << m_hits << " (" << (double)(100 * m_hits) / m_valuesCache.Count() << "%)" << std::endl;
+
+	//if (std::is_same<IntImpl, uint64_t>::value)
+	std::cout << "MAXULONGLONG: " << std::numeric_limits<IntImpl>::max()/* ULLONG_MAX*/ << std::endl;
+}
+
+
+// calculate range of numbers in record-only mode (option --records-only).
+// numbers are calculated in blocks of PRINT_VALUE, inner loop has no progress counters and no statistics,
+// both records are checked by one branch that is almost never taken. speed is measured per block
+template<typename IntImpl>
+void ThreeN1<IntImpl>::Calc3p1RangeFast(const IntImpl& start, const IntImpl& finish)
+{
+	PROFILE_ZONE("range compute");
+	uint64_t maxsteps = 0, lineCnt = 0;
+	uint64_t num1 = 0, num2 = 0; // offsets of numbers with records of max value and steps from start
+	IntImpl maxmaxv = 0ull;
+	CalcDataType calcData{ 0ull, 0ull };
+	std::locale loc(std::cout.getloc(), new MyGroupSeparator());
+
+	const uint64_t PRINT_VALUE = 1'000'000; // print "progress" on each 1Mth number
+	const uint64_t count = toULongLong(finish - start);
+	auto start0 = std::chrono::high_resolution_clock::now();
+	auto start1 = start0;
+	std::chrono::high_resolution_clock::time_point stop;
+#ifdef USE_PERF_COUNTERS
+	std::unique_ptr<PerfCounters> perf;
+	PerfSample perf0;
+	if (m_perf) perf = std::make_unique<PerfCounters>(), perf0 = perf->Read();
+#endif
+
+	IntImpl i = start;
+	uint64_t offset = 0;
+	for (uint64_t done = 0; done < count; )
 	{
-		if (m_unused.get(i) == false)
+		uint64_t block = std::min(PRINT_VALUE, count - done);
+		const uint64_t blockEnd = done + block;
+
+		if (m_stepsTable.Size() > 0) // records of steps only
 		{
-			if (numOfFirst > 0)
+			for (; offset < blockEnd; ++offset, ++i)
 			{
-				str = str + "," + std::to_string(i);
-				numOfFirst--;
+				uint64_t steps = Calc3p1Steps(i);
+				if (maxsteps < steps) [[unlikely]]
+				{
+					num2 = offset;
+					maxsteps = steps;
+					std::cout << std::format(loc, "[{:3}] Number: {:>25} | STEPS: {:>5L}", lineCnt++, i, steps) << std::endl;
+					metricsRecord("steps", i, std::to_string(steps));
+				}
 			}
-			unused++;
+		}
+		else
+		{
+			for (; offset < blockEnd; ++offset, ++i)
+			{
+				Calc3p1Fast(i, calcData);
+
+				if ((maxsteps < calcData.steps) | (maxmaxv < calcData.maxvalue)) [[unlikely]] // new record of steps or max value
+				{
+					if (maxmaxv < calcData.maxvalue)
+					{
+						num1 = offset;
+						maxmaxv = calcData.maxvalue;
+						std::cout << std::format("[{:3}] Number: {:>25} | steps: {:>5L} | MAX VALUE: {:>25}", lineCnt++, i, calcData.steps, calcData.maxvalue) << std::endl;
+						metricsRecord("maxvalue", i, MetricsWriter::Str(calcData.maxvalue));
+					}
+
+					if (maxsteps < calcData.steps)
+					{
+						num2 = offset;
+						maxsteps = calcData.steps;
+						std::cout << std::format(loc, "[{:3}] Number: {:>25} | STEPS: {:>5L} | max value: {:>25}", lineCnt++, i, calcData.steps, calcData.maxvalue) << std::endl;
+						metricsRecord("steps", i, std::to_string(calcData.steps));
+					}
+				}
+			}
+		}
+
+		done += block;
+
+		if (block == PRINT_VALUE) // show progress after each full block
+		{
+			stop = std::chrono::high_resolution_clock::now();
+			auto ms = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(stop - start1).count());
+			auto speed = PRINT_VALUE * 1000 / ms;
+			if (m_metrics.IsOpen()) // steps are not counted in this mode
+			{
+				double avg = done / std::chrono::duration<double>(stop - start0).count();
+				metricsProgress(done, (double)speed, 0, std::format("{}", speed), avg > 0 ? ((count - done) / avg) : -1);
+			}
+			std::cout << '\r' << i << " (speed: " << speed << " num/sec) \r";
+			start1 = std::chrono::high_resolution_clock::now();
 		}
 	}
 
-	std::cout << "Unused numbers total: " << unused << std::endl;
-	std::cout << "Unused numbers (first " << SHOW_FIRST_UNUSED << "): " << str << std::endl;
-	std::cout << "Cache size: " << m_valuesCache.Count() << std::endl;
-	std::cout << "Cache Hits: " << m_hits << " (" << (double)(100 * m_hits) / m_valuesCache.Count() << "%)" << std::endl;
+	stop = std::chrono::high_resolution_clock::now();
 
-	//if (std::is_same<IntImpl, uint64_t>::value)
-	std::cout << "MAXULONGLONG: " << std::numeric_limits<IntImpl>::max()/* ULLONG_MAX*/ << std::endl;
-}
+	std::cout << "                                             \r" << std::endl; // clear progress counter
 
+	auto calcTime = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(stop - start0).count());
+	std::cout << "Average Speed: " << count * 1000 / calcTime << " num/sec" << std::endl;
+#ifdef USE_PERF_COUNTERS
+	if (perf) std::cout << "Hardware counters: " << (perf->Read() - perf0).ToString() << std::endl;
+#endif
+	std::cout << "Calculation time: " << MillisecToStr(calcTime) << std::endl;
+
+	IntImpl msnum = RangeNumber(start, num2), mvnum = RangeNumber(start, num1);
+	auto num = std::max(msnum, mvnum);
+	uint64_t dig;
+	if constexpr (std::is_same<IntImpl, BigInt>::value) // for BigInt only
+		dig = (uint64_t)(Length(num) * 1.35);
+	else
+		dig = (uint64_t)((log10(num) + 1)*1.35); // +30% for spaces between groups by 3 digits 
+
+	std::cout << std::format(loc, "Number: {:>{}} | max steps: {}", msnum, dig, maxsteps) << std::endl;
+	if (m_stepsTable.Size() == 0)
+		std::cout << std::format(loc, "Number: {:>{}} | max value: {}", mvnum, dig, maxmaxv) << std::endl;
+}
 
 // calculate big range using threads.
-// rance then is divided into subranges 10'000'000 numbers each - each subrange is task for one thread
+// range is divided into subranges m_taskRange (10'000'000 by default) numbers each.
+// each thread of the pool runs one ThreeN1Task that takes subranges one by one via NextRange()
+// and keeps all per-thread state in its own ThreeN1Context
 template<typename IntImpl>
 void ThreeN1<IntImpl>::Calc3p1allThreads(const IntImpl& start, const IntImpl& finish, uint64_t threadsCnt)
 {
@@ -524,9 +1124,15 @@ void ThreeN1<IntImpl>::Calc3p1allThreads(const IntImpl& start, const IntImpl& fi
 	//CalcDataType calcData{ 0ull, 0ull };
 	IntImpl range = finish - start;
 
+	if constexpr (std::is_same<IntImpl, BigInt>::value) // sub-ranges are addressed by uint64_t offsets
+	{
+		if (range > std::numeric_limits<uint64_t>::max())
+			throw std::invalid_argument("Error: range is too wide for calculation in threads.\n");
+	}
+
 #ifdef USE_VALUES_CACHE
 	m_valuesCache.Clear();
-	m_valuesCache.SetCapacity((uint)(toULongLong(range);// +2ull));
+	m_valuesCache.SetCapacity(toULongLong(range));
 #endif
 
 	//const uint64_t MIN_RANGE = 2'000'000; // if range is less than this value - use single thread mode for calculation
@@ -536,80 +1142,245 @@ void ThreeN1<IntImpl>::Calc3p1allThreads(const IntImpl& start, const IntImpl& fi
 	//	return;
 	//}
 
-	MT::ThreadPool thread_pool((int)threadsCnt);
+	m_rangeData.Clear();
+	m_rangeBase = start;
+	m_rangeWidth = toULongLong(range);
+	m_rangesTotal = (m_rangeWidth + m_taskRange - 1) / m_taskRange;
+	m_printRanges = m_taskRange >= PRINT_TASK_RANGE_MIN;
+	m_batchSize = std::max<uint64_t>(1, ONE_TASK_RANGE_DEF / m_taskRange); // about 10M numbers per batch
+	m_nextRange = 0;
+	m_rangesDone = 0;
+	m_records = RecordsData<IntImpl>();
+	m_known = RecordsData<IntImpl>();
+	m_checkpointsCnt = 0;
+	m_checkpointsTime = 0;
+
+	if (m_resume)
+	{
+		readCheckpoint(); // throws if checkpoint does not match the range
+		m_rangesDone = m_resumedRanges.CountTrue();
+		m_records = m_resumedRecords;
+		m_known = m_records;
+		std::cout << "Resuming from checkpoint '" << m_checkpointFile << "'. Sub-ranges already completed: " << m_rangesDone << std::endl;
+	}
+	else
+	{
+		m_resumedRanges.Init(m_rangesTotal);
+		m_resumedRecords = RecordsData<IntImpl>();
+		m_resumedResultsSize = 0;
+	}
+
+	if(m_rangesTotal > 1'000'000 && m_taskRange >= ONE_TASK_RANGE_DEF)
+		std::cout << "Too wide range (" << start << "," << finish << "). It may take too much time to calculate." << std::endl;
+
+	std::osyncstream syncout(std::cout);
+	syncout.imbue(std::locale(std::cout.getloc(), new MyGroupSeparator()));
+
+	syncout << "Sub-ranges total: " << m_rangesTotal << " (" << m_taskRange << " numbers each)" << std::endl;
+	syncout.emit();
+
+	std::ofstream resultsFile;
+	if (!m_resultsFile.empty())
+	{
+		// after resume results of earlier sub-ranges are in the file already, append new ones.
+		// results written after the last checkpoint are cut off, those sub-ranges are calculated again
+		if (m_resume && std::filesystem::exists(m_resultsFile) && std::filesystem::file_size(m_resultsFile) > m_resumedResultsSize)
+			std::filesystem::resize_file(m_resultsFile, m_resumedResultsSize);
+
+		resultsFile.open(m_resultsFile, std::ios::out | std::ios::binary | (m_resume ? std::ios::app : std::ios::trunc));
+		if (resultsFile.fail())
+			throw std::invalid_argument("Error: cannot open file '" + m_resultsFile + "'\n");
+	}
+
+	if (!m_columnsFile.empty())
+	{
+		std::stringstream base;
+		base << m_rangeBase;
+		m_columns.Open(m_columnsFile, base.str(), ColumnEncoder::BLOCK_SIZE);
+	}
+
+	// pool is created with at least hardware_concurrency threads, so the number of active threads can grow during calculation.
+	// contexts are created for active threads only, parked threads that were never activated take only their stacks
+	bool autoThreads = threadsCnt == THREADS_AUTO;
+	uint64_t hwThreads = std::max<uint64_t>(1, std::thread::hardware_concurrency());
+	uint64_t poolSize = std::max(threadsCnt, hwThreads);
+	if (autoThreads) threadsCnt = hwThreads;
+
+	m_contexts.clear();
+	m_contexts.resize(poolSize);
+
+	m_allTaken = false;
+	SetActiveThreads(threadsCnt);
+	ThreadsTuner tuner(poolSize);
+	if (!autoThreads) tuner.Stop();
+	syncout << "Threads: " << threadsCnt << (autoThreads ? " (auto)" : "") << ", max: " << poolSize << std::endl;
+	syncout.emit();
+
+#ifdef SIGUSR1
+	ThreadsDeltaRequested = 0;
+	auto prevUsr1 = std::signal(SIGUSR1, ThreadsSignalHandler);
+	auto prevUsr2 = std::signal(SIGUSR2, ThreadsSignalHandler);
+#endif
+
+	// reducer and writer stages run in dedicated threads
+	m_reduceQueue.Reopen();
+	m_writeQueue.Reopen();
+	m_persistedRanges.Assign(m_resumedRanges);
+	std::thread reducer(&ThreeN1<IntImpl>::reduceStage, this);
+	std::thread writer(&ThreeN1<IntImpl>::writeStage, this, resultsFile.is_open() ? &resultsFile : nullptr);
+
+	MT::ThreadPool thread_pool((int)poolSize);
 	//thread_pool.set_logger_flag(true);
 
+	auto start0 = std::chrono::high_resolution_clock::now();
+
+	m_unused.SetConcurrent(true);
+
 	// remove the pool from a pause, allowing streams to take on the tasks on the fly
 	thread_pool.start();
 
-	std::vector<std::shared_ptr<ThreeN1Task<IntImpl>>> stanbyTasks;
-	const uint64_t TASK_POOL_SIZE = 100;
-	const uint64_t TASK_POOL_INITIAL_SIZE = 3ull * TASK_POOL_SIZE / 2 + (threadsCnt+1); // one extra task just for sure
-	const uint64_t TASK_POOL_THRESHOLD = TASK_POOL_SIZE / 2;
-	const uint64_t ONE_TASK_RANGE = 10'000'000ull;
+	for (uint64_t j = 0; j < poolSize; j++) // one long living task per thread
+		thread_pool.add_task(ThreeN1Task<IntImpl>(*this, j));
 
-	for (int j = 0; j < TASK_POOL_INITIAL_SIZE; j++) // total number of tasks need to be 1.5 times larger 
+	auto prevTime = start0;
+	uint64_t prevNumbers = 0, prevSteps = 0;
+	std::vector<uint64_t> prevProgress(poolSize, 0);
+	while (true)
 	{
-		stanbyTasks.push_back(std::make_shared<ThreeN1Task<IntImpl>>(*this));
-	}
+		{
+			std::unique_lock<std::mutex> lock(m_activeMutex);
+			if (m_doneCv.wait_for(lock, std::chrono::seconds(1), [&] { return m_rangesDone.load(std::memory_order_acquire) >= m_rangesTotal; }))
+				break;
+		}
 
-	IntImpl rangeCount = range / ONE_TASK_RANGE;
+		syncout << "Sub-ranges processed: " << m_rangesDone.load(std::memory_order_relaxed) << " of " << m_rangesTotal << std::endl;
 
-	if(rangeCount > 1'000'000)
-		std::cout << "Too wide range (" << start << "," << finish << "). It may take too much time to calculate." << std::endl;
+		auto now = std::chrono::high_resolution_clock::now();
+		uint64_t numbers = 0;
+		for (auto& ctx : m_contexts)
+			if (ctx) numbers += ctx->progress.load(std::memory_order_relaxed);
 
-	std::osyncstream syncout(std::cout);
-	syncout.imbue(std::locale(std::cout.getloc(), new MyGroupSeparator()));
+		uint64_t active = m_activeThreads.load(std::memory_order_relaxed);
+		bool draining = false; // parked threads still calculate their last sub-ranges
+		for (uint64_t j = active; j < poolSize; j++)
+			draining |= m_contexts[j] && m_contexts[j]->busy.load(std::memory_order_relaxed);
 
-	IntImpl rangeStart = start;
-	uint64_t tasksCount = 0;
-	while (true) //(rangeStart < finish)
-	{
-		bool lastRange = false;
+		std::string report;
+		double sec = std::chrono::duration<double>(now - prevTime).count();
+		uint64_t newActive = tuner.Update(active, numbers - prevNumbers, sec, draining, report);
+		if (!report.empty()) syncout << report << std::endl;
 
-		if (thread_pool.task_queue_size() < TASK_POOL_THRESHOLD)
+		int delta = ThreadsDeltaRequested.exchange(0, std::memory_order_relaxed);
+		if (delta != 0) // manual change stops auto tuning
 		{
-			syncout << "Tasks processed: " << tasksCount << std::endl;
-			syncout << "Tasks in queue: " << thread_pool.task_queue_size() << std::endl;
-			//syncout << "Tasks completed: " << thread_pool.tasks_completed() << std::endl;
-			syncout << "Tasks standby: " << stanbyTasks.size() << std::endl;
+			tuner.Stop();
+			newActive = std::clamp<int64_t>((int64_t)active + delta, 1, (int64_t)poolSize);
+		}
 
-			for (int j = 0; j < TASK_POOL_SIZE; j++, rangeStart+=ONE_TASK_RANGE) // total number of tasks need to be 1.5 times larger 
-			{
-				IntImpl rangeFinish = rangeStart + ONE_TASK_RANGE;
-				if (rangeFinish >= finish)
-				{
-					rangeFinish = finish;
-					lastRange = true;
-				}
+		if (newActive != active)
+		{
+			SetActiveThreads(newActive);
+			syncout << "Active threads: " << newActive << std::endl;
+		}
 
-				std::shared_ptr<ThreeN1Task<IntImpl>> task = stanbyTasks.back(); // [stanbyTasks.size() - 1];
-				stanbyTasks.pop_back();
-				task->InitTask(rangeStart, rangeFinish); // put new range into exisiting (cached) task object
-				thread_pool.add_task(*task);
-				tasksCount++;
-				if (lastRange) break; // we've added the last range for processing, stopping the loop then
+		if (m_metrics.IsOpen())
+		{
+			uint64_t steps = 0;
+			std::string threadSpeeds;
+			for (uint64_t j = 0; j < poolSize; j++)
+			{
+				if (!m_contexts[j]) continue;
+				uint64_t progress = m_contexts[j]->progress.load(std::memory_order_relaxed);
+				steps += m_contexts[j]->stepsProgress.load(std::memory_order_relaxed);
+				if (j < active) threadSpeeds += std::format("{}{:.0f}", j ? ", " : "", (progress - prevProgress[j]) / sec);
+				prevProgress[j] = progress;
 			}
-		}
 
-		if (lastRange) break;
+			double avg = numbers / std::chrono::duration<double>(now - start0).count();
+			uint64_t remaining = (m_rangesTotal - m_rangesDone.load(std::memory_order_relaxed)) * m_taskRange;
+			metricsProgress(numbers, (numbers - prevNumbers) / sec, (steps - prevSteps) / sec, threadSpeeds, avg > 0 ? remaining / avg : -1);
+			prevSteps = steps;
+		}
 
-		std::this_thread::sleep_for(std::chrono::seconds(1));
-		
-		thread_pool.move_completed(stanbyTasks); // move completed tasks back to standbyTasks and clean up completed tasks list		
+		syncout.emit();
+		prevTime = now;
+		prevNumbers = numbers;
 	}
 
-	syncout << std::endl << "All tasks added. Waiting till they finished." << std::endl;
+	// wake up parked workers, so they can finish their tasks
+	{
+		std::lock_guard<std::mutex> lock(m_activeMutex);
+		m_allTaken = true;
+	}
+	m_activeCv.notify_all();
 
 	thread_pool.wait();
-	thread_pool.move_completed(stanbyTasks);
+	m_unused.SetConcurrent(false);
 
-	assert(stanbyTasks.size() == TASK_POOL_INITIAL_SIZE);
+#ifdef SIGUSR1
+	std::signal(SIGUSR1, prevUsr1);
+	std::signal(SIGUSR2, prevUsr2);
+#endif
 
 	syncout << "ALL TASKS COMPLETED" << std::endl;
 
 	thread_pool.stop();
 
+	// all workers handed their last batches, let reducer and writer finish remaining ones
+	m_reduceQueue.Close();
+	reducer.join();
+	writer.join();
+
+	if (resultsFile.is_open())
+	{
+		resultsFile.close();
+		if (!m_resume) rangeDataToFile(m_resultsFile); // rewrite file with results sorted by range start. m_rangeData does not have resumed sub-ranges
+	}
+
+	uint64_t numbers = 0, errors = 0;
+	for (auto& ctx : m_contexts)
+	{
+		if (!ctx) continue;
+		numbers += ctx->numbers;
+		errors += ctx->errors;
+	}
+
+	syncout << "Numbers calculated: " << numbers << std::endl;
+	if (errors > 0) syncout << "Sub-ranges with errors: " << errors << std::endl;
+	m_hist.Clear();
+	for (auto& ctx : m_contexts)
+		if (ctx) m_hist.Merge(ctx->hist);
+	if (m_resume && m_resumedRanges.CountTrue() > 0) // histograms are per thread and include running sub-ranges, so they are not checkpointed
+		syncout << "Histograms cover numbers calculated in this session only, sub-ranges completed before resume are not included." << std::endl;
+	histReport(syncout, start, finish, m_histFile.empty() && !m_resultsFile.empty() ? m_resultsFile + ".hist" : m_histFile);
+
+	if (m_columns.IsOpen())
+	{
+		m_columns.Close();
+		syncout << "Columns are written into: " << m_columnsFile << " numbers: " << m_columns.Numbers() << " bytes: " << m_columns.Bytes()
+			<< std::format(" ({:.2f} bytes/number)", m_columns.Numbers() > 0 ? (double)m_columns.Bytes() / m_columns.Numbers() : 0.0) << std::endl;
+	}
+#ifdef USE_PERF_COUNTERS
+	if (m_perf)
+	{
+		PerfSample perf;
+		for (auto& ctx : m_contexts)
+			if (ctx) perf += ctx->perfTotal;
+		syncout << "Hardware counters (all threads): " << perf.ToString() << std::endl;
+	}
+#endif
+	syncout << "Number: " << m_records.msnum << " | max steps: " << m_records.maxsteps << std::endl;
+	if (m_stepsTable.Size() == 0) // max value is not searched with steps table
+		syncout << "Number: " << m_records.mvnum << " | max value: " << m_records.maxvalue << std::endl;
+
+	if (!m_checkpointFile.empty())
+	{
+		auto calcTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start0).count();
+		syncout << "Checkpoints written: " << m_checkpointsCnt << " time: " << MillisecToStr(m_checkpointsTime);
+		if (calcTime > 0) syncout << std::format(" ({:.3f}% of calculation time)", 100.0 * m_checkpointsTime / calcTime);
+		syncout << std::endl;
+	}
+
 	//syncout << "number:" << num2 << "  max steps:" << maxsteps << std::endl;
 	//syncout << "number:" << num1 << "  max value:" << maxmaxv << std::endl;
 #ifdef USE_VALUES_CACHE
@@ -620,6 +1391,299 @@ void ThreeN1<IntImpl>::Calc3p1allThreads(const IntImpl& start, const IntImpl& fi
 	syncout << "MAXULONGLONG:" << std::numeric_limits<IntImpl>::max()/* ULLONG_MAX*/ << std::endl;
 }
 
+// writes progress event into metrics stream. threadSpeeds is comma separated list of num/sec of active threads
+template<typename IntImpl>
+void ThreeN1<IntImpl>::metricsProgress(uint64_t numbers, double numPerSec, double stepsPerSec, const std::string& threadSpeeds, double etaSec)
+{
+	if (!m_metrics.IsOpen()) return;
+
+	std::string hitRate = m_valuesCache.Count() > 0 && numbers > 0 ? std::format("{:.4f}", (double)m_hits / numbers) : "null"; // cache is used in single thread mode only
+	m_metrics.Write("progress", std::format("\"numbers\": {}, \"num_per_sec\": {:.0f}, \"steps_per_sec\": {:.0f}, \"threads\": [{}], "
+		"\"reduce_queue\": {}, \"write_queue\": {}, \"cache_hit_rate\": {}, \"rss\": {}, \"eta_sec\": {:.0f}",
+		numbers, numPerSec, stepsPerSec, threadSpeeds, m_reduceQueue.Size(), m_writeQueue.Size(), hitRate, CurrentRss(), etaSec));
+}
+
+// prints summary of histograms and saves them into fileName if it is not empty
+template<typename IntImpl>
+void ThreeN1<IntImpl>::histReport(std::ostream& out, const IntImpl& start, const IntImpl& finish, const std::string& fileName)
+{
+	if (m_hist.Count() == 0) return;
+
+	out << m_hist.Summary() << std::endl;
+	if (!fileName.empty())
+	{
+		std::stringstream s1, s2;
+		s1 << start;
+		s2 << finish;
+		m_hist.Save(fileName, s1.str(), s2.str());
+		out << "Histograms are saved into: " << fileName << std::endl;
+	}
+}
+
+// prints number of unused numbers and the first of them, exports all of them into m_unusedFile if it is set.
+// file format: var_len_encode of bits count, of unused numbers count and of differences between consecutive unused numbers
+// (the first one is counted from 0)
+template<typename IntImpl>
+void ThreeN1<IntImpl>::unusedReport(std::ostream& out)
+{
+	const uint SHOW_FIRST_UNUSED = 30;
+	const uint64_t bits = m_unused.BitsCount();
+	uint64_t unused = 0;
+	if (bits > 1) // bypass 0 number, it is never touched
+		unused = bits - 1 - (m_unused.CountTrue(std::thread::hardware_concurrency()) - m_unused.get(0));
+
+	uint numOfFirst = SHOW_FIRST_UNUSED;
+	std::string str;
+	m_unused.ForEachFalse(1, [&](uint64_t i)
+	{
+		str += "," + std::to_string(i);
+		return --numOfFirst > 0;
+	});
+
+	out << "Unused numbers total: " << unused << std::endl;
+	out << "Unused numbers (first " << SHOW_FIRST_UNUSED << "): " << str << std::endl;
+
+	if (!m_unusedFile.empty())
+	{
+		std::ofstream f(m_unusedFile, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (f.fail())
+			throw std::invalid_argument("Error: cannot open file '" + m_unusedFile + "'\n");
+
+		std::vector<uint8_t> buf(1 << 16);
+		size_t offset = var_len_encode(buf.data(), bits);
+		offset += var_len_encode(buf.data() + offset, unused);
+		uint64_t prev = 0;
+		m_unused.ForEachFalse(1, [&](uint64_t i)
+		{
+			offset += var_len_encode(buf.data() + offset, i - prev);
+			prev = i;
+			if (offset > buf.size() - 9)
+			{
+				f.write((const char*)buf.data(), offset);
+				offset = 0;
+			}
+			return true;
+		});
+		f.write((const char*)buf.data(), offset);
+
+		f.flush();
+		if (f.fail())
+			throw std::invalid_argument("Error: cannot write file '" + m_unusedFile + "'\n");
+		out << "Unused numbers are exported into: " << m_unusedFile << std::endl;
+	}
+
+	m_unused.Optimize();
+	out << "Unused numbers bitset: " << m_unused.MemoryUsage() / 1024 << " KB" << std::endl;
+}
+
+// writes record event into metrics stream. kind is "steps" or "maxvalue", value is JSON value of the record
+template<typename IntImpl>
+void ThreeN1<IntImpl>::metricsRecord(const char* kind, const IntImpl& number, const std::string& value)
+{
+	if (!m_metrics.IsOpen()) return;
+
+	m_metrics.Write("record", std::format("\"kind\": \"{}\", \"number\": {}, \"value\": {}", kind, MetricsWriter::Str(number), value));
+}
+
+// reducer stage of threaded calculation.
+// takes batches of sub-range results from workers, stores them in m_rangeData, updates records of whole range
+// prints results and passes batches further to writer stage
+template<typename IntImpl>
+void ThreeN1<IntImpl>::reduceStage()
+{
+	std::osyncstream syncout(std::cout);
+	std::locale loc(std::cout.getloc(), new MyGroupSeparator());
+	syncout.imbue(loc);
+
+	RangeBatch batch;
+	while (m_reduceQueue.Pop(batch))
+	{
+		PROFILE_ZONE("record reduction");
+		for (const RangeData<IntImpl>& rd : batch)
+		{
+			addRangeData(rd);
+
+			if (rd.status == ThreeN1Task<IntImpl>::TaskStatus::error)
+				syncout << "range: (" << rd.start << "," << rd.finish << ") current number: " << rd.errnum << " ERROR during range calculation: " << rd.error << std::endl;
+			else if (m_printRanges)
+			{
+				// records-only results keep only numbers above records known at start of the sub-range, others are shown as "-"
+				const bool hasSteps = !m_recordsOnly || rd.num1steps > 0;
+				const bool hasValue = !m_recordsOnly || rd.num2maxvalue > rd.start;
+				syncout << std::format(loc, "Range:({:L}, {:L}) Max steps: ", toULongLong(rd.start), toULongLong(rd.finish));
+				if (hasSteps) syncout << std::format(loc, "{:5L} ({:L})", rd.num1steps, toULongLong(rd.num1));
+				else syncout << "    -";
+				if (m_stepsTable.Size() > 0) syncout << " Max value: n/a"; // max value is not searched with steps table
+				else if (hasValue) syncout << std::format(loc, " Max value: {:25L} ({:L})", toULongLong(rd.num2maxvalue), toULongLong(rd.num2));
+				else syncout << " Max value:                         -";
+#ifdef USE_PERF_COUNTERS
+				if (m_perf) syncout << ' ' << rd.perf.ToString();
+#endif
+				syncout << std::endl;
+			}
+
+			int newRecords = m_records.Update(rd);
+			if (newRecords && m_recordsOnly)
+			{
+				std::lock_guard<std::mutex> lock(m_knownMutex);
+				m_known = m_records;
+			}
+
+			if (newRecords & RecordsData<IntImpl>::NEW_STEPS)
+			{
+				syncout << std::format(loc, "Number: {:>25} | STEPS: {:>5L} | new record", m_records.msnum, m_records.maxsteps) << std::endl;
+				metricsRecord("steps", m_records.msnum, std::to_string(m_records.maxsteps));
+			}
+
+			if ((newRecords & RecordsData<IntImpl>::NEW_MAXVALUE) && m_stepsTable.Size() == 0)
+			{
+				syncout << std::format(loc, "Number: {:>25} | MAX VALUE: {:>25} | new record", m_records.mvnum, m_records.maxvalue) << std::endl;
+				metricsRecord("maxvalue", m_records.mvnum, MetricsWriter::Str(m_records.maxvalue));
+			}
+		}
+
+		syncout.emit();
+		m_writeQueue.Push(std::move(batch));
+		batch.clear();
+	}
+
+	m_writeQueue.Close();
+}
+
+// writer stage of threaded calculation.
+// appends results of sub-ranges into results file as soon as they are reduced
+// and writes checkpoints each m_checkpointInterval seconds.
+// f is nullptr when results are not saved
+template<typename IntImpl>
+void ThreeN1<IntImpl>::writeStage(std::ofstream* f)
+{
+	RecordsData<IntImpl> records = m_resumedRecords; // records of persisted sub-ranges only
+	auto lastCheckpoint = std::chrono::steady_clock::now();
+
+	RangeBatch batch;
+	while (m_writeQueue.Pop(batch))
+	{
+		PROFILE_ZONE("results write");
+		for (const RangeData<IntImpl>& rd : batch)
+		{
+			if (f) writeRangeData(*f, rd);
+			records.Update(rd);
+			m_persistedRanges.setTrue(rd.index);
+		}
+
+		if (f) f->flush(); // results must be in the file before checkpoint marks these sub-ranges completed
+
+		if (!m_checkpointFile.empty() && std::chrono::steady_clock::now() - lastCheckpoint >= std::chrono::seconds(m_checkpointInterval))
+		{
+			if (f) syncResults(); // flush() only passes results to OS, they must be on the disk before checkpoint
+			writeCheckpoint(records, f ? (uint64_t)f->tellp() : 0);
+			lastCheckpoint = std::chrono::steady_clock::now();
+		}
+	}
+
+	if (f) syncResults();
+	if (!m_checkpointFile.empty())
+		writeCheckpoint(records, f ? (uint64_t)f->tellp() : 0); // final checkpoint, all sub-ranges are persisted
+}
+
+template<typename IntImpl>
+void ThreeN1<IntImpl>::syncResults()
+{
+	if (!SyncFile(m_resultsFile))
+		std::cout << "Error: cannot flush results file '" << m_resultsFile << "' to disk." << std::endl;
+}
+
+// writes checkpoint of threaded calculation: parameters of the range, persisted sub-ranges,
+// records of persisted sub-ranges, size of results file and unused numbers bitset.
+// file is written under temporary name and then renamed, so checkpoint file is either old or new one, never partial
+template<typename IntImpl>
+void ThreeN1<IntImpl>::writeCheckpoint(const RecordsData<IntImpl>& records, uint64_t resultsSize)
+{
+	PROFILE_ZONE("checkpoint save");
+	auto start = std::chrono::high_resolution_clock::now();
+	std::string tmpName = m_checkpointFile + ".tmp";
+
+	{
+		std::ofstream f;
+		f.open(tmpName, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (f.fail())
+		{
+			std::cout << "Error: cannot open checkpoint file '" << tmpName << "'. Checkpoint skipped." << std::endl;
+			return;
+		}
+
+		f << CHECKPOINT_SIGNATURE << '\n';
+		f << m_rangeBase << ' ' << m_rangeWidth << ' ' << m_taskRange << '\n';
+		f << records.maxsteps << ' ' << records.msnum << ' ' << records.maxvalue << ' ' << records.mvnum << '\n';
+		f << resultsSize << ' ' << m_persistedRanges.BitsCount() << ' ' << m_unused.BitsCount() << '\n';
+		f.write((const char*)m_persistedRanges.Data(), m_persistedRanges.WordsCount() * sizeof(uint64_t));
+		m_unused.Write(f); // bits of running sub-ranges are also here, that's fine
+
+		f.close();
+		if (f.fail() || !SyncFile(tmpName)) // data must be on the disk before rename, otherwise crash can leave empty checkpoint
+		{
+			std::cout << "Error: cannot write checkpoint file '" << tmpName << "'. Checkpoint skipped." << std::endl;
+			return;
+		}
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tmpName, m_checkpointFile, ec);
+	if (ec)
+	{
+		std::cout << "Error: cannot rename checkpoint file '" << tmpName << "': " << ec.message() << std::endl;
+		return;
+	}
+	SyncDir(std::filesystem::path(m_checkpointFile).parent_path().string()); // rename itself is durable after this
+
+	m_checkpointsCnt++;
+	m_checkpointsTime += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// reads checkpoint written by writeCheckpoint into m_resumedRanges, m_resumedRecords and m_unused
+// range parameters in checkpoint must be the same as parameters of current calculation
+template<typename IntImpl>
+void ThreeN1<IntImpl>::readCheckpoint()
+{
+	std::ifstream f;
+	f.open(m_checkpointFile, std::ios::in | std::ios::binary);
+	if (f.fail())
+		throw std::invalid_argument("Error: cannot open checkpoint file '" + m_checkpointFile + "'\n");
+
+	std::string signature;
+	IntImpl base;
+	uint64_t width, taskRange, rangesCnt, unusedCnt;
+
+	f >> signature;
+	if (signature != CHECKPOINT_SIGNATURE)
+		throw std::invalid_argument("Error: '" + m_checkpointFile + "' is not a checkpoint file.\n");
+
+	f >> base >> width >> taskRange;
+	if (base != m_rangeBase || width != m_rangeWidth || taskRange != m_taskRange)
+		throw std::invalid_argument("Error: checkpoint '" + m_checkpointFile + "' was written for another range or sub-range size.\n");
+
+	f >> m_resumedRecords.maxsteps >> m_resumedRecords.msnum >> m_resumedRecords.maxvalue >> m_resumedRecords.mvnum;
+	f >> m_resumedResultsSize >> rangesCnt >> unusedCnt;
+	f.get(); // '\n' after the last number
+
+	if (rangesCnt != m_rangesTotal)
+		throw std::invalid_argument("Error: checkpoint file '" + m_checkpointFile + "' is corrupted.\n");
+
+	m_resumedRanges.Init(rangesCnt);
+	f.read((char*)m_resumedRanges.Data(), m_resumedRanges.WordsCount() * sizeof(uint64_t));
+
+	if (unusedCnt == m_unused.BitsCount())
+	{
+		if (!m_unused.Read(f))
+			throw std::invalid_argument("Error: checkpoint file '" + m_checkpointFile + "' is corrupted.\n");
+	}
+	else
+		std::cout << "Unused numbers range differs from checkpoint, unused numbers from checkpoint are ignored." << std::endl;
+
+	if (f.fail())
+		throw std::invalid_argument("Error: checkpoint file '" + m_checkpointFile + "' is corrupted.\n");
+}
+
 template<typename IntImpl>
 void ThreeN1<IntImpl>::CacheToFileBin(const IntImpl& start, const std::string& fileName)
 {
@@ -652,6 +1716,7 @@ void ThreeN1<IntImpl>::CacheToFileBin(const IntImpl& start, const std::string& f
 template<typename IntImpl>
 void ThreeN1<IntImpl>::CacheFromFileBin(const std::string& fileName)
 {
+	PROFILE_ZONE("cache load");
 	std::ifstream f;
 	f.open(fileName, std::ios::out | std::ios::binary);
 	if (f.fail())
@@ -666,7 +1731,7 @@ void ThreeN1<IntImpl>::CacheFromFileBin(const std::string& fileName)
 	//f.read(&start, sizeof(IntImpl));
 	//f.read(&cnt, sizeof(IntImpl));
 
-	m_valuesCache.SetCapacity((uint)toULongLong(cnt)); //TODO performance degradation here!!! 
+	m_valuesCache.SetCapacity(toULongLong(cnt));
 	CalcDataType val;
 	while (true)
 	{
@@ -685,6 +1750,7 @@ void ThreeN1<IntImpl>::CacheFromFileBin(const std::string& fileName)
 template<typename IntImpl>
 void ThreeN1<IntImpl>::rangeDataToFile(const std::string& fileName)
 {
+	PROFILE_ZONE("file save");
 	std::ofstream f;
 	//fout.exceptions(/*ifstream::failbit |*/ ifstream::badbit);
 	f.open(fileName, std::ios::out | std::ios::binary);
@@ -692,27 +1758,76 @@ void ThreeN1<IntImpl>::rangeDataToFile(const std::string& fileName)
 		throw std::invalid_argument("Error: cannot open file '" + fileName + "'\n");
 
 	for (uint64_t i = 0; i < m_rangeData.Count(); ++i)
-	{
-		RangeData<IntImpl> data = m_rangeData[i];
-
-		f << data.start;
-		f << ',';
-		f << data.finish;
-		f << ',';
-		f << data.num1;
-		f << '=';
-		f << data.num1steps;
-		f << ',';
-		f << data.num2;
-		f << '=';
-		f << data.num2maxvalue;
-		f << " (";
-		f << NumLen(data.num2maxvalue);
-		f << "dig)";
-		if (data.status == ThreeN1Task<IntImpl>::TaskStatus::error) f << " *ERROR* errnum:" << data.errnum;
-		f << "\n";
-	}
+		writeRangeData(f, m_rangeData[i]);
 
 	f.flush();
 	f.close();
 }
+
+template<typename IntImpl>
+void ThreeN1<IntImpl>::writeRangeData(std::ostream& f, const RangeData<IntImpl>& data)
+{
+	f << data.start;
+	f << ',';
+	f << data.finish;
+	f << ',';
+	f << data.num1;
+	f << '=';
+	f << data.num1steps;
+	f << ',';
+	f << data.num2;
+	f << '=';
+	f << data.num2maxvalue;
+	f << " (";
+	f << NumLen(data.num2maxvalue);
+	f << "dig)";
+	if (data.status == ThreeN1Task<IntImpl>::TaskStatus::error) f << " *ERROR* errnum:" << data.errnum;
+	f << "\n";
+}
+
+// reads one line written by writeRangeData, returns false at the end of stream or if line has wrong format
+// format: start,finish,num1=num1steps,num2=num2maxvalue (N dig)[ *ERROR* errnum:N]
+template<typename IntImpl>
+bool ThreeN1<IntImpl>::readRangeData(std::istream& f, RangeData<IntImpl>& data)
+{
+	std::string line;
+	if (!std::getline(f, line)) return false;
+
+	try
+	{
+		size_t p1 = line.find(',');
+		size_t p2 = line.find(',', p1 + 1);
+		size_t p3 = line.find('=', p2 + 1);
+		size_t p4 = line.find(',', p3 + 1);
+		size_t p5 = line.find('=', p4 + 1);
+		size_t p6 = line.find(' ', p5 + 1);
+		if (p6 == std::string::npos) return false;
+
+		data.index = 0;
+		data.start = StrToInt<IntImpl>(line.substr(0, p1));
+		data.finish = StrToInt<IntImpl>(line.substr(p1 + 1, p2 - p1 - 1));
+		data.num1 = StrToInt<IntImpl>(line.substr(p2 + 1, p3 - p2 - 1));
+		data.num1steps = std::stoull(line.substr(p3 + 1, p4 - p3 - 1));
+		data.num2 = StrToInt<IntImpl>(line.substr(p4 + 1, p5 - p4 - 1));
+		data.num2maxvalue = StrToInt<IntImpl>(line.substr(p5 + 1, p6 - p5 - 1));
+
+		const std::string ERRNUM = "errnum:";
+		size_t p7 = line.find(ERRNUM, p6);
+		if (p7 == std::string::npos)
+		{
+			data.errnum = 0ull;
+			data.status = ThreeN1Task<IntImpl>::TaskStatus::completed;
+		}
+		else
+		{
+			data.errnum = StrToInt<IntImpl>(line.substr(p7 + ERRNUM.length()));
+			data.status = ThreeN1Task<IntImpl>::TaskStatus::error;
+		}
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ThreeN1.h"
+
+// Splits one big range between several worker processes (on one or several hosts).
+// Processes communicate via shared directory with lease files:
+//   shards.txt   - description of whole range: start, finish, shard size, number of shards
+//   pending/N    - shard N waiting for worker. File contains start and finish of the shard
+//   leased/N.ID  - shard N is calculated by worker ID. Worker updates file modification time while shard is in progress
+//   done/N       - results of shard N (RangeData lines, see ThreeN1::writeRangeData)
+//   complete     - created by coordinator when results of all shards are merged, workers exit after that
+// Shard is taken by renaming pending/N into leased/N.ID, rename is atomic so only one worker gets the shard.
+// Coordinator moves leases that were not updated during lease timeout back into pending/.
+template<typename IntImpl>
+class ThreeN1Shards
+{
+private:
+	ThreeN1<IntImpl>& m_calc;
+	std::filesystem::path m_dir;
+
+	const std::string SHARDS_FILE = "shards.txt";
+	const std::string COMPLETE_FILE = "complete";
+
+	static std::string shardName(uint64_t index)
+	{
+		return std::format("{:012}", index);
+	}
+
+	static bool readShard(const std::filesystem::path& fileName, IntImpl& start, IntImpl& finish)
+	{
+		std::ifstream f(fileName, std::ios::in | std::ios::binary);
+		f >> start >> finish;
+		return !f.fail();
+	}
+
+	// file appears under its name complete: data is written into temporary file in the root of shared directory
+	// (not in pending/, where workers could take it) and renamed, rename is atomic
+	void writeFile(const std::filesystem::path& fileName, const std::string& data) const
+	{
+		std::filesystem::path tmp = m_dir / (fileName.filename().string() + ".tmp");
+		{
+			std::ofstream f(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (f.fail())
+				throw std::invalid_argument("Error: cannot open file '" + tmp.string() + "'\n");
+			f << data;
+			f.close();
+			if (f.fail())
+				throw std::invalid_argument("Error: cannot write file '" + tmp.string() + "'\n");
+		}
+		std::filesystem::rename(tmp, fileName);
+	}
+
+	std::filesystem::path dir(const char* sub) const
+	{
+		return m_dir / sub;
+	}
+
+public:
+	static const uint64_t SHARD_SIZE_DEF = 1'000'000'000ull;
+	static const uint64_t LEASE_TIMEOUT_DEF = 300; // seconds
+
+	ThreeN1Shards(ThreeN1<IntImpl>& calc, const std::string& dirName): m_calc(calc), m_dir(dirName)
+	{
+	}
+
+	void Coordinate(const IntImpl& start, const IntImpl& finish, uint64_t shardSize, uint64_t leaseTimeout);
+	void Work(uint64_t threadsCnt, uint64_t leaseTimeout);
+};
+
+// creates shards for the range (if they are not created yet by previous run of coordinator),
+// then merges results of shards returned by workers and reassigns expired leases until all shards are done
+template<typename IntImpl>
+void ThreeN1Shards<IntImpl>::Coordinate(const IntImpl& start, const IntImpl& finish, uint64_t shardSize, uint64_t leaseTimeout)
+{
+	namespace fs = std::filesystem;
+
+	fs::create_directories(dir("pending"));
+	fs::create_directories(dir("leased"));
+	fs::create_directories(dir("done"));
+
+	uint64_t shardsCnt;
+	if (fs::exists(m_dir / SHARDS_FILE)) // coordinator is restarted, continue with existing shards
+	{
+		IntImpl s, f;
+		uint64_t size;
+		std::ifstream fin(m_dir / SHARDS_FILE, std::ios::in | std::ios::binary);
+		fin >> s >> f >> size >> shardsCnt;
+		if (fin.fail() || s != start || f != finish)
+			throw std::invalid_argument("Error: directory '" + m_dir.string() + "' has shards of another range.\n");
+		std::cout << "Continue with existing shards: " << shardsCnt << std::endl;
+	}
+	else
+	{
+		IntImpl shardStart = start;
+		for (shardsCnt = 0; shardStart < finish; shardsCnt++)
+		{
+			IntImpl shardFinish = shardStart + shardSize;
+			if (shardFinish > finish) shardFinish = finish;
+
+			std::stringstream data;
+			data << shardStart << ' ' << shardFinish << '\n';
+			writeFile(dir("pending") / shardName(shardsCnt), data.str());
+			shardStart = shardFinish;
+		}
+
+		// shards.txt is written last, so interrupted creation of shards is started again
+		std::stringstream data;
+		data << start << ' ' << finish << ' ' << shardSize << ' ' << shardsCnt << '\n';
+		writeFile(m_dir / SHARDS_FILE, data.str());
+		std::cout << "Shards created: " << shardsCnt << std::endl;
+	}
+
+	std::set<std::string> merged;
+	RecordsData<IntImpl> records;
+	m_calc.m_rangeData.Clear();
+
+	while (merged.size() < shardsCnt)
+	{
+		// merge results of finished shards
+		for (const auto& entry : fs::directory_iterator(dir("done")))
+		{
+			std::string name = entry.path().filename().string();
+			if (merged.contains(name) || entry.path().extension() == ".tmp") continue;
+
+			std::ifstream fin(entry.path(), std::ios::in | std::ios::binary);
+			RangeData<IntImpl> rd;
+			while (m_calc.readRangeData(fin, rd))
+			{
+				m_calc.addRangeData(rd);
+				int newRecords = records.Update(rd);
+				if (newRecords & RecordsData<IntImpl>::NEW_STEPS)
+					std::cout << std::format("Number: {:>25} | STEPS: {:>5} | new record", records.msnum, records.maxsteps) << std::endl;
+				if (newRecords & RecordsData<IntImpl>::NEW_MAXVALUE)
+					std::cout << std::format("Number: {:>25} | MAX VALUE: {:>25} | new record", records.mvnum, records.maxvalue) << std::endl;
+			}
+
+			merged.insert(name);
+			fs::remove(dir("pending") / name); // shard could be reassigned and finished later by slow worker
+			std::cout << "Shard " << name << " merged (" << merged.size() << " of " << shardsCnt << ")" << std::endl;
+		}
+
+		// move expired leases back to pending
+		auto now = fs::file_time_type::clock::now();
+		for (const auto& entry : fs::directory_iterator(dir("leased")))
+		{
+			std::error_code ec;
+			auto mtime = fs::last_write_time(entry.path(), ec);
+			if (ec || now - mtime < std::chrono::seconds(leaseTimeout)) continue;
+
+			std::string name = entry.path().stem().string(); // leased/N.ID -> N
+			if (!merged.contains(name))
+			{
+				fs::rename(entry.path(), dir("pending") / name, ec);
+				if (!ec) std::cout << "Lease " << entry.path().filename().string() << " expired, shard returned to pending." << std::endl;
+			}
+			else
+				fs::remove(entry.path(), ec);
+		}
+
+		if (merged.size() < shardsCnt)
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+
+	writeFile(m_dir / COMPLETE_FILE, "");
+
+	std::cout << "ALL SHARDS MERGED" << std::endl;
+	std::cout << "Number: " << records.msnum << " | max steps: " << records.maxsteps << std::endl;
+	std::cout << "Number: " << records.mvnum << " | max value: " << records.maxvalue << std::endl;
+
+	if (!m_calc.m_resultsFile.empty())
+		m_calc.rangeDataToFile(m_calc.m_resultsFile);
+}
+
+// takes pending shards one by one and calculates them in threads till coordinator reports that all shards are done
+template<typename IntImpl>
+void ThreeN1Shards<IntImpl>::Work(uint64_t threadsCnt, uint64_t leaseTimeout)
+{
+	namespace fs = std::filesystem;
+
+	std::random_device rd;
+	std::string workerId = std::format("{:08x}{:08x}", rd(), rd());
+	std::cout << "Worker ID: " << workerId << std::endl;
+
+	uint64_t heartbeat = std::max<uint64_t>(1, leaseTimeout / 4);
+
+	while (!fs::exists(m_dir / COMPLETE_FILE))
+	{
+		// try to take any pending shard
+		std::string name;
+		fs::path lease;
+		if (fs::exists(dir("pending")))
+		{
+			for (const auto& entry : fs::directory_iterator(dir("pending")))
+			{
+				std::error_code ec;
+				lease = dir("leased") / (entry.path().filename().string() + "." + workerId);
+				// rename keeps modification time, so pending file is touched first: otherwise coordinator could see
+				// old lease and return it to pending before its time is updated
+				fs::last_write_time(entry.path(), fs::file_time_type::clock::now(), ec);
+				if (ec) continue; // taken by other worker
+				fs::rename(entry.path(), lease, ec);
+				if (!ec)
+				{
+					name = entry.path().filename().string();
+					break;
+				}
+			}
+		}
+
+		if (name.empty()) // no pending shards at the moment, some could return after lease expiration
+		{
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			continue;
+		}
+
+		IntImpl start, finish;
+		if (!readShard(lease, start, finish))
+		{
+			// shard files are created by rename, so it is an error of shared file system. shard is returned for the next attempt
+			std::cout << "Error: cannot read shard file '" << lease.string() << "', shard returned to pending." << std::endl;
+			std::error_code ec;
+			fs::rename(lease, dir("pending") / name, ec);
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			continue;
+		}
+
+		std::cout << "Shard " << name << " taken: " << start << " - " << finish << std::endl;
+
+		// update lease modification time while shard is in progress
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool done = false;
+		std::thread keeper([&]
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (!cv.wait_for(lock, std::chrono::seconds(heartbeat), [&] { return done; }))
+				{
+					std::error_code ec;
+					fs::last_write_time(lease, fs::file_time_type::clock::now(), ec); // if lease is lost, shard still is calculated till the end
+				}
+			});
+
+		auto stopKeeper = [&]
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					done = true;
+				}
+				cv.notify_one();
+				keeper.join();
+			};
+
+		try
+		{
+			m_calc.Calc3p1allThreads(start, finish, threadsCnt);
+		}
+		catch (...)
+		{
+			// lease is released at once, so other worker does not wait for lease timeout
+			stopKeeper();
+			std::error_code ec;
+			fs::rename(lease, dir("pending") / name, ec);
+			std::cout << "Shard " << name << " failed, returned to pending." << std::endl;
+			throw;
+		}
+		stopKeeper();
+
+		// results become visible to coordinator by atomic rename
+		fs::path tmp = dir("done") / (name + ".tmp");
+		m_calc.rangeDataToFile(tmp.string());
+		fs::rename(tmp, dir("done") / name);
+
+		std::error_code ec;
+		fs::remove(lease, ec);
+		std::cout << "Shard " << name << " done." << std::endl;
+	}
+
+	std::cout << "All shards are done." << std::endl;
+}
+
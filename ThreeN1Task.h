@@ -20,91 +20,305 @@ class ThreeN1;
 template<typename IntImpl>
 struct RangeData;
 
+template<typename IntImpl>
+struct RecordsData;
+
+struct RangeDescr;
+
+// Execution context of one worker thread.
+// It is created in Calc3p1allThreads when the thread becomes active first time and reused for every sub-range calculated by that thread:
+// threads above requested count may never be activated, so they do not take memory of histograms.
+// Context owns scratch buffers of the thread and the batch of results that is not yet handed to reducer stage.
+template<typename IntImpl>
+class ThreeN1Context
+{
+public:
+	const uint64_t index; // index of worker thread, workers with index >= ThreeN1::m_activeThreads are parked
+
+	typename ThreeN1<IntImpl>::CalcDataType calcData; // scratch result of one number
+	RangeData<IntImpl> rd;  // scratch results of current sub-range
+	RecordsData<IntImpl> known; // records of whole range known at start of current sub-range, used by records-only calculation
+	typename ThreeN1<IntImpl>::RangeBatch batch; // results of calculated sub-ranges waiting for reducer
+	ColumnEncoder columns;  // per-number export of current sub-range, used if ThreeN1::m_columns is open
+	Histograms hist;        // distribution of steps and max values of numbers calculated by this thread
+
+	// accumulated counters of this thread
+	uint64_t ranges = 0;    // number of calculated sub-ranges
+	uint64_t numbers = 0;   // number of calculated numbers
+	uint64_t errors = 0;    // number of sub-ranges finished with error
+	uint64_t steps = 0;     // total steps of calculated numbers
+
+	// numbers calculated so far including current sub-range and failed ones. written by this thread only, read by progress loop
+	std::atomic<uint64_t> progress = 0;
+	std::atomic<uint64_t> stepsProgress = 0; // steps, published together with progress
+	std::atomic<bool> busy = false; // sub-range is being calculated, parked thread with busy set still finishes it
+	static const uint64_t PROGRESS_STEP = 0x10000; // progress is updated once per PROGRESS_STEP numbers
+
+#ifdef USE_PERF_COUNTERS
+	std::unique_ptr<PerfCounters> perf; // counters of the worker thread, opened by the thread itself
+	PerfSample perfTotal;
+#endif
+
+	ThreeN1Context(uint64_t idx): index(idx)
+	{
+	}
+};
+
+// Worker task of thread pool (compute stage of the pipeline).
+// Exactly one task is created per pool thread. The task takes sub-ranges (RangeDescr) from parent ThreeN1 object
+// one by one and calculates them until whole range is done.
+// Results are handed to reducer stage in batches, compute thread never blocks on output.
 template<typename IntImpl>
 class ThreeN1Task : public MT::Task
 {
 private:
-	IntImpl m_start, m_end; // current range
-	IntImpl m_mvnum;        // number from the range that generates max value in 3p1 sequence
-	IntImpl m_msnum;        // number from the range that generates max steps in 3p1 sequence
-	IntImpl m_maxvalue;     // max value reached during calculating current range
-	uint64_t m_maxsteps;         // max value of steps in 3p1 sequence in current range
 	ThreeN1<IntImpl>& m_parent;
+	const uint64_t m_index; // index of worker thread
+	ThreeN1Context<IntImpl>* m_ctx = nullptr; // context is taken when the thread becomes active
 
 	static inline uint seq = 0;
+	static const uint64_t NO_RECORD = UINT64_MAX; // offset of record in calcRangeFast when known records are not beaten
 
 public:
-	ThreeN1Task(ThreeN1<IntImpl>& parent): Task(std::to_string(++seq)), m_parent(parent)
+	ThreeN1Task(ThreeN1<IntImpl>& parent, uint64_t index): Task(std::to_string(++seq)), m_parent(parent), m_index(index)
 	{
 	};
 
-	void InitTask(IntImpl start, IntImpl end)
+	void one_thread_method() override
 	{
-		m_start = start;
-		m_end = end;
-		status = TaskStatus::awaiting;
+		RangeDescr descr;
+		if (!m_parent.WaitActive(m_index)) return; // the thread was never activated
+		m_ctx = m_parent.m_contexts[m_index].get();
+#ifdef USE_PERF_COUNTERS
+		if (m_parent.m_perf && !m_ctx->perf) m_ctx->perf = std::make_unique<PerfCounters>();
+#endif
+		while (m_parent.WaitActive(m_index) && m_parent.NextRange(descr))
+		{
+			m_ctx->busy.store(true, std::memory_order_relaxed);
+#ifdef USE_PERF_COUNTERS
+			PerfSample perf0 = m_ctx->perf ? m_ctx->perf->Read() : PerfSample();
+#endif
+			if (m_parent.m_recordsOnly)
+				calcRangeFast(descr);
+			else
+				calcRange(descr);
+#ifdef USE_PERF_COUNTERS
+			if (m_ctx->perf) // calcRange always adds one sub-range into the batch
+			{
+				m_ctx->batch.back().perf = m_ctx->perf->Read() - perf0;
+				m_ctx->perfTotal += m_ctx->batch.back().perf;
+			}
+#endif
+			m_ctx->busy.store(false, std::memory_order_relaxed);
+			m_parent.RangeDone();
+
+			// if reducer queue is full, results are kept in the batch and handed over with the next sub-range
+			if (m_ctx->batch.size() >= m_parent.m_batchSize && m_parent.m_reduceQueue.TryPush(m_ctx->batch))
+				m_ctx->batch.clear();
+		}
+
+		// nothing to calculate anymore, so it is safe to wait for free space in the queue
+		if (!m_ctx->batch.empty())
+			m_parent.m_reduceQueue.Push(std::move(m_ctx->batch));
+		m_ctx->batch.clear();
+
+		if constexpr (std::is_same<IntImpl, BigInt>::value)
+			BigIntArena::Release(); // buffers cached by this thread are not needed till the next calculation
 	}
 
-	void one_thread_method() override
+private:
+	void calcRange(const RangeDescr& descr)
 	{
-		// std::osyncstream scout(std::cout);
-		// scout << "[" << id << "] " << "Starting task: " << std::endl;
-
-		typename ThreeN1<IntImpl>::CalcDataType calcData;
-		m_maxvalue = m_start;
-		m_mvnum = m_start;
-		m_maxsteps = 0;
-		m_msnum = m_start;
+		PROFILE_ZONE("range compute");
+		typename ThreeN1<IntImpl>::CalcDataType& calcData = m_ctx->calcData;
+		RangeData<IntImpl>& rd = m_ctx->rd;
+		beginRange(descr);
 
-		std::osyncstream syncout(std::cout);
-		std::locale loc(std::cout.getloc(), new MyGroupSeparator());
-		syncout.imbue(loc);
+		ColumnEncoder* columns = m_parent.m_columns.IsOpen() ? &m_ctx->columns : nullptr;
+		if (columns) columns->Begin(descr.offset);
 
-		for (IntImpl i = m_start; i < m_end; i++)
+		uint64_t progress = m_ctx->progress.load(std::memory_order_relaxed);
+		uint64_t num1 = 0, num2 = 0; // offsets of numbers with records of steps and max value
+		IntImpl i = rd.start;
+		for (uint64_t offset = 0; offset < descr.count; ++offset, ++i)
 		{
+			if (((offset + 1) & (ThreeN1Context<IntImpl>::PROGRESS_STEP - 1)) == 0)
+			{
+				m_ctx->progress.store(progress + offset + 1, std::memory_order_relaxed);
+				m_ctx->stepsProgress.store(m_ctx->steps, std::memory_order_relaxed);
+			}
+
 			try
 			{
 				m_parent.Calc3p1(i, calcData);
+				m_ctx->steps += calcData.steps;
+				m_ctx->hist.Add(calcData.steps, IntLog2(calcData.maxvalue));
+
+				if (rd.num2maxvalue < calcData.maxvalue) rd.num2maxvalue = calcData.maxvalue, num2 = offset;
+				if (rd.num1steps < calcData.steps)       rd.num1steps = calcData.steps,       num1 = offset;
 
-				if (m_maxvalue < calcData.maxvalue) m_maxvalue = calcData.maxvalue, m_mvnum = i;
-				if (m_maxsteps < calcData.steps)    m_maxsteps = calcData.steps,    m_msnum = i;
+				if (columns && columns->Add(calcData.steps, Log2(calcData.maxvalue)))
+					columns->Flush(m_parent.m_columns);
 			}
-			catch (std::overflow_error & ex) // add intermediate range results into list and stop calc this range 
+			catch (...) // overflow or any other exception means range is not finished - error. keep intermediate range results and stop calc this range
 			{
-				status = TaskStatus::error;
-				m_parent.addRangeData(getRangeData(i));	
-				syncout << std::setw(5) << "[" << id << "] " << "range: (" << m_start << "," << m_end << ") current number: " << i << " " << ex.what() << std::endl;
-				throw;
+				if (columns) columns->Flush(m_parent.m_columns); // numbers before errnum
+				m_ctx->progress.store(progress + offset, std::memory_order_relaxed); // numbers before errnum are calculated
+				m_ctx->stepsProgress.store(m_ctx->steps, std::memory_order_relaxed);
+				setRecords(num1, num2);
+				rangeError(i);
+				return;
 			}
-			catch (...) // any exception means tasks is not finished - error
+		}
+
+		if (columns) columns->Flush(m_parent.m_columns);
+		setRecords(num1, num2);
+		finishRange(descr, progress);
+	}
+
+	// record-only variant of calcRange: no steps are counted, progress is published per block of PROGRESS_STEP numbers,
+	// records of the sub-range are thresholds, so a number takes one branch only when it beats one of them.
+	// with steps table only steps are searched, max value of sub-range remains its start
+	void calcRangeFast(const RangeDescr& descr)
+	{
+		PROFILE_ZONE("range compute");
+		typename ThreeN1<IntImpl>::CalcDataType& calcData = m_ctx->calcData;
+		RangeData<IntImpl>& rd = m_ctx->rd;
+		beginRange(descr);
+
+		// thresholds are records of whole range reduced before the sub-range starts, not records of the sub-range:
+		// numbers that do not beat them can't be new records, so the branch below is taken only by record candidates.
+		// records of greater numbers (sub-ranges finished earlier or before resume) lose ties (see RecordsData::Update),
+		// so their thresholds are one less and numbers of this sub-range that equal them take the branch too
+		RecordsData<IntImpl>& known = m_ctx->known;
+		m_parent.KnownRecords(known);
+		rd.num1steps = known.maxsteps;
+		if (rd.num1steps > 0 && rd.start < known.msnum) --rd.num1steps;
+		if (rd.start < known.maxvalue)
+		{
+			rd.num2maxvalue = known.maxvalue;
+			if (rd.start < known.mvnum) --rd.num2maxvalue;
+		}
+
+		uint64_t progress = m_ctx->progress.load(std::memory_order_relaxed);
+		const bool stepsOnly = m_parent.m_stepsTable.Size() > 0; // records of steps only, trajectories are cut by steps table
+		uint64_t num1 = NO_RECORD, num2 = NO_RECORD, offset = 0; // offsets of numbers with records and of current number
+		IntImpl i = rd.start;
+		try
+		{
+			for (uint64_t done = 0; done < descr.count; )
 			{
-				status = TaskStatus::error;
-				m_parent.addRangeData(getRangeData(i));
-				syncout << std::setw(5) << "[" << id << "] " << "range: (" << m_start << "," << m_end << ") current number:" << i << "ERROR during range calculation!" << std::endl;
-				throw;
+				uint64_t block = std::min(descr.count - done, (uint64_t)ThreeN1Context<IntImpl>::PROGRESS_STEP);
+				const uint64_t blockEnd = done + block;
+
+				if (stepsOnly)
+				{
+					for (; offset < blockEnd; ++offset, ++i)
+					{
+						uint64_t steps = m_parent.Calc3p1Steps(i);
+						if (rd.num1steps < steps) [[unlikely]] rd.num1steps = steps, num1 = offset;
+					}
+				}
+				else
+				{
+					for (; offset < blockEnd; ++offset, ++i)
+					{
+						m_parent.Calc3p1Fast(i, calcData);
+
+						if ((rd.num1steps < calcData.steps) | (rd.num2maxvalue < calcData.maxvalue)) [[unlikely]]
+						{
+							if (rd.num2maxvalue < calcData.maxvalue) rd.num2maxvalue = calcData.maxvalue, num2 = offset;
+							if (rd.num1steps < calcData.steps)       rd.num1steps = calcData.steps,       num1 = offset;
+						}
+					}
+				}
+
+				done += block;
+				m_ctx->progress.store(progress + done, std::memory_order_relaxed);
 			}
 		}
+		catch (...) // overflow, numbers before i are calculated
+		{
+			m_ctx->progress.store(progress + offset, std::memory_order_relaxed);
+			setFastRecords(num1, num2);
+			rangeError(i);
+			return;
+		}
+
+		setFastRecords(num1, num2);
+		finishRange(descr, progress);
+	}
 
-		m_parent.addRangeData(getRangeData());
+	// initializes scratch results of the sub-range
+	void beginRange(const RangeDescr& descr)
+	{
+		RangeData<IntImpl>& rd = m_ctx->rd;
 
-		//scout << "[" << id << "] " << "Calculated, storing results... " << std::endl;
-		syncout << std::format(loc, "[{:2}] Range:({:L}, {:L}) Max steps: {:5L} ({:L}) Max value: {:25L} ({:L})", id, toULongLong(m_start), toULongLong(m_end), m_maxsteps, toULongLong(m_msnum), toULongLong(m_maxvalue), toULongLong(m_mvnum)) << std::endl;
-		//syncout << "[" << id << "] " << "range: (" << m_start << "," << m_end << ")  max steps: " << m_maxsteps << " (" << m_msnum << ")" << "  max value: " << m_maxvalue << " (" << m_mvnum << ")" << std::endl;
-		
+		rd.index = descr.index;
+		rd.start = m_parent.m_rangeBase;
+		rd.start += descr.offset;
+		rd.finish = rd.start;
+		rd.finish += descr.count;
+		rd.num1 = rd.start;        // number from the range that generates max steps in 3p1 sequence
+		rd.num1steps = 0;          // max value of steps in 3p1 sequence in current range
+		rd.num2 = rd.start;        // number from the range that generates max value in 3p1 sequence
+		rd.num2maxvalue = rd.start;// max value reached during calculating current range
+		rd.errnum = 0ull;
+		rd.status = TaskStatus::processing;
+		rd.error.clear();
 	}
 
-	RangeData<IntImpl> getRangeData(IntImpl errnum = 0ull)
+	// records of the sub-range are kept as offsets from its start, numbers are built once per sub-range
+	void setRecords(uint64_t num1, uint64_t num2)
 	{
-		RangeData<IntImpl> rd;
-		rd.start = m_start;
-		rd.finish = m_end;
-		rd.num1 = m_msnum;
-		rd.num2 = m_mvnum;
-		rd.num1steps = m_maxsteps;
-		rd.num2maxvalue = m_maxvalue;
+		RangeData<IntImpl>& rd = m_ctx->rd;
+		rd.num1 = RangeNumber(rd.start, num1);
+		rd.num2 = RangeNumber(rd.start, num2);
+	}
+
+	// records of calcRangeFast: sub-range without numbers above known records gets empty results set by beginRange
+	void setFastRecords(uint64_t num1, uint64_t num2)
+	{
+		RangeData<IntImpl>& rd = m_ctx->rd;
+		if (num1 == NO_RECORD) rd.num1steps = 0, num1 = 0;
+		if (num2 == NO_RECORD) rd.num2maxvalue = rd.start, num2 = 0;
+		setRecords(num1, num2);
+	}
+
+	// stores results of completed sub-range, progress is the value before the sub-range
+	void finishRange(const RangeDescr& descr, uint64_t progress)
+	{
+		RangeData<IntImpl>& rd = m_ctx->rd;
+		rd.status = TaskStatus::completed;
+		m_ctx->batch.push_back(rd);
+		m_ctx->ranges++;
+		m_ctx->numbers += descr.count;
+		m_ctx->progress.store(progress + descr.count, std::memory_order_relaxed);
+		m_ctx->stepsProgress.store(m_ctx->steps, std::memory_order_relaxed);
+	}
+
+	// stores intermediate results of the range that failed on number errnum. called from catch block,
+	// message of the exception being handled is kept for reducer
+	void rangeError(const IntImpl& errnum)
+	{
+		RangeData<IntImpl>& rd = m_ctx->rd;
+		rd.status = TaskStatus::error;
 		rd.errnum = errnum;
-		rd.status = status;
-		return rd;
+		try
+		{
+			throw;
+		}
+		catch (const std::exception& e)
+		{
+			rd.error = e.what();
+		}
+		catch (...)
+		{
+			rd.error = "unknown exception";
+		}
+		m_ctx->batch.push_back(rd);
+		m_ctx->ranges++;
+		m_ctx->errors++;
 	}
 };
 
@@ -1,5 +1,16 @@
 #include <iostream>
 //#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#include <new>
 #include "Utils.h"
 #include "string_utils.h"
 
@@ -16,6 +27,39 @@ uint64_t NumLen(const BigInt& num)
     return Length(num);
 }
 
+// flushes data of file from OS cache to the disk, so it survives crash of OS or power loss
+bool SyncFile(const std::string& fileName)
+{
+#ifdef _WIN32
+    HANDLE h = CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    bool result = FlushFileBuffers(h) != 0;
+    CloseHandle(h);
+    return result;
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool result = fsync(fd) == 0;
+    close(fd);
+    return result;
+#endif
+}
+
+// flushes directory entries (created, renamed files) of directory to the disk.
+// NTFS journals renames itself and directories cannot be flushed on Windows
+bool SyncDir(const std::string& dirName)
+{
+#ifdef _WIN32
+    return true;
+#else
+    int fd = open(dirName.empty() ? "." : dirName.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return false;
+    bool result = fsync(fd) == 0;
+    close(fd);
+    return result;
+#endif
+}
+
 // reading one varlen number from file
 size_t VarLenReadBuf(std::ifstream& fin, uint8_t* buf)
 {
@@ -30,6 +74,58 @@ size_t VarLenReadBuf(std::ifstream& fin, uint8_t* buf)
     return maxSize;
 }
 
+uint64_t PeakRss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize;
+    return 0;
+#else
+#ifdef __linux__
+    // VmHWM is reset by ResetPeakRss, ru_maxrss is not
+    std::ifstream f("/proc/self/status");
+    std::string line;
+    while (std::getline(f, line))
+    {
+        if (line.rfind("VmHWM:", 0) == 0)
+            return std::stoull(line.substr(6)) * 1024; // "VmHWM:    1234 kB"
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return (uint64_t)usage.ru_maxrss * 1024; // kilobytes on Linux
+    return 0;
+#endif
+}
+
+bool ResetPeakRss()
+{
+#ifdef __linux__
+    std::ofstream f("/proc/self/clear_refs");
+    f << "5"; // resets peak RSS to current RSS, Linux 4.0+
+    f.close();
+    return !f.fail();
+#else
+    return false;
+#endif
+}
+
+uint64_t CurrentRss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.WorkingSetSize;
+    return 0;
+#else
+    std::ifstream f("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    f >> size >> resident; // in pages
+    return resident * (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
 std::string RemoveApo(const std::string& str)
 {
     std::string res;
@@ -143,3 +239,116 @@ size_t var_len_decode(const uint8_t buf[], size_t size_max, uint64_t* num)
 
     return i;
 }
+
+#if defined(__linux__) && !defined(MAP_HUGE_SHIFT)
+#define MAP_HUGE_SHIFT 26
+#endif
+
+void* HugePages::Alloc(size_t bytes)
+{
+    Free();
+
+    if (bytes < PAGE_2M) // small array fits into a few TLB entries anyway
+    {
+        m_ptr = calloc(std::max<size_t>(bytes, 1), 1);
+        if (!m_ptr) throw std::bad_alloc();
+        m_size = bytes;
+        m_kind = HEAP;
+        return m_ptr;
+    }
+
+#ifdef _WIN32
+    // large pages need SeLockMemoryPrivilege, without it VirtualAlloc fails and ordinary pages are used
+    size_t large = GetLargePageMinimum();
+    if (large > 0)
+    {
+        size_t size = (bytes + large - 1) / large * large;
+        m_ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (m_ptr)
+        {
+            m_size = size;
+            m_kind = EXPLICIT_2M;
+            return m_ptr;
+        }
+    }
+
+    m_ptr = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!m_ptr) throw std::bad_alloc();
+    m_size = bytes;
+    m_kind = ORDINARY;
+    return m_ptr;
+#elif defined(__linux__)
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    // explicit huge pages exist only if they are reserved (vm.nr_hugepages, hugepagesz=1G), otherwise mmap fails at once
+    const struct { size_t page; int flags; Kind kind; } explicitPages[] = {
+        { PAGE_1G, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), EXPLICIT_1G },
+        { PAGE_2M, MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), EXPLICIT_2M },
+    };
+    for (const auto& ep : explicitPages)
+    {
+        if (bytes < ep.page) continue; // last page would be mostly wasted
+        size_t size = (bytes + ep.page - 1) / ep.page * ep.page;
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | ep.flags, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            m_ptr = p;
+            m_size = size;
+            m_kind = ep.kind;
+            return m_ptr;
+        }
+    }
+
+    // transparent huge pages cover only 2 MB aligned parts of region, so region is aligned by cutting off its ends
+    size_t size = (bytes + PAGE_2M - 1) / PAGE_2M * PAGE_2M;
+    void* p = mmap(nullptr, size + PAGE_2M, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+
+    uint8_t* begin = (uint8_t*)p;
+    uint8_t* aligned = (uint8_t*)(((uintptr_t)begin + PAGE_2M - 1) & ~(uintptr_t)(PAGE_2M - 1));
+    if (aligned > begin) munmap(begin, aligned - begin);
+    if (begin + PAGE_2M > aligned) munmap(aligned + size, begin + PAGE_2M - aligned);
+
+    m_ptr = aligned;
+    m_size = size;
+    m_kind = madvise(aligned, size, MADV_HUGEPAGE) == 0 ? TRANSPARENT_2M : ORDINARY;
+    return m_ptr;
+#else
+    m_ptr = calloc(bytes, 1);
+    if (!m_ptr) throw std::bad_alloc();
+    m_size = bytes;
+    m_kind = HEAP;
+    return m_ptr;
+#endif
+}
+
+void HugePages::Free()
+{
+    if (m_kind == HEAP)
+        free(m_ptr);
+    else if (m_ptr)
+    {
+#ifdef _WIN32
+        VirtualFree(m_ptr, 0, MEM_RELEASE);
+#else
+        munmap(m_ptr, m_size);
+#endif
+    }
+
+    m_ptr = nullptr;
+    m_size = 0;
+    m_kind = NONE;
+}
+
+const char* HugePages::KindStr(Kind kind)
+{
+    switch (kind)
+    {
+    case HEAP: return "heap";
+    case ORDINARY: return "4 KB pages";
+    case TRANSPARENT_2M: return "transparent 2 MB pages";
+    case EXPLICIT_2M: return "2 MB pages";
+    case EXPLICIT_1G: return "1 GB pages";
+    default: return "none";
+    }
+}
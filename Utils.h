@@ -4,6 +4,10 @@
 #include <locale>
 #include <fstream>
 #include <cassert>
+#include <bit>
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 #include "BigInt.h"
 
@@ -21,10 +25,64 @@ uint64_t NumLen(uint64_t num);
 uint64_t NumLen(const BigInt& num);
 
 std::string RemoveApo(const std::string& str);
+uint64_t PeakRss(); // peak resident set size of the process (since ResetPeakRss on Linux), bytes
+bool ResetPeakRss(); // starts new measurement of PeakRss, returns false if OS does not allow it (only Linux does)
+uint64_t CurrentRss(); // current resident set size of the process, bytes
+bool SyncFile(const std::string& fileName); // fsync, FlushFileBuffers on Windows
+bool SyncDir(const std::string& dirName); // fsync of directory, empty name is current directory
 size_t VarLenReadBuf(std::ifstream& fin, uint8_t* buf);
 size_t var_len_encode(uint8_t buf[9], uint64_t num);
 size_t var_len_decode(const uint8_t buf[], size_t size_max, uint64_t* num);
 
+// zero-filled memory of big arrays (values cache, bitsets). Random lookups into multi-GB arrays miss TLB on almost
+// every access with 4 KB pages, so memory is taken from explicit 1 GB or 2 MB huge pages (MAP_HUGETLB, MEM_LARGE_PAGES)
+// if OS has them reserved, otherwise from transparent huge pages requested by madvise, otherwise from ordinary pages.
+// arrays smaller than one huge page are allocated by calloc
+class HugePages
+{
+public:
+	enum Kind { NONE, HEAP, ORDINARY, TRANSPARENT_2M, EXPLICIT_2M, EXPLICIT_1G };
+
+	static const size_t PAGE_2M = 2ull << 20;
+	static const size_t PAGE_1G = 1ull << 30;
+
+	HugePages() {}
+	~HugePages()
+	{
+		Free();
+	}
+
+	HugePages(const HugePages&) = delete;
+	HugePages& operator=(const HugePages&) = delete;
+
+	void* Alloc(size_t bytes); // frees previous memory, throws std::bad_alloc if there is no memory at all
+	void Free();
+
+	void Swap(HugePages& other)
+	{
+		std::swap(m_ptr, other.m_ptr);
+		std::swap(m_size, other.m_size);
+		std::swap(m_kind, other.m_kind);
+	}
+
+	void* Data() const
+	{
+		return m_ptr;
+	}
+
+	Kind GetKind() const
+	{
+		return m_kind;
+	}
+
+	static const char* KindStr(Kind kind);
+
+private:
+	void* m_ptr = nullptr;
+	size_t m_size = 0; // size of mapping, rounded up to page size
+	Kind m_kind = NONE;
+};
+
 
 class MyBitset
 {
@@ -35,6 +93,7 @@ private:
 
 	uint64_t m_bits = 0;
 	uint64_t* m_arr = nullptr; 
+	HugePages m_mem; // memory of m_arr
 
 	//	bool get_bit(uint64_t word, uint32_t offset)
 	//	{
@@ -66,18 +125,16 @@ public:
 		Init(bitsCount);
 	}
 
-	~MyBitset()
-	{
-		free(m_arr);
-		m_arr = nullptr;
-	}
-
 	void Init(uint64_t bitsCount)
 	{
-		if (m_arr) free(m_arr); // free previously allocated memory.
 		m_bits = bitsCount;
 		uint64_t wordsCnt = (bitsCount + (BITS_IN_WORD - 1ULL)) / BITS_IN_WORD;
-		m_arr = (uint64_t*)calloc(wordsCnt, sizeof(uint64_t)); // initialises memory to zero
+		m_arr = (uint64_t*)m_mem.Alloc(wordsCnt * sizeof(uint64_t)); // frees previously allocated memory, initialises memory to zero
+	}
+
+	HugePages::Kind PagesKind() const
+	{
+		return m_mem.GetKind();
 	}
 
 	inline bool get(uint64_t bitIndex) const
@@ -92,7 +149,7 @@ public:
 
 	inline void setTrue(BigInt& bitIndex)
 	{
-		setTrue(toULongLong(bitIndex));
+		setTrue(bitIndex.to_u64());
 	}
 
 	inline void setTrue(uint64_t bitIndex)
@@ -110,5 +167,66 @@ public:
 	{
 		return m_bits;
 	}
+
+	// raw access to the words of bitset, used for saving/loading bitset to/from file
+	inline uint64_t WordsCount() const
+	{
+		return (m_bits + (BITS_IN_WORD - 1ULL)) / BITS_IN_WORD;
+	}
+
+	inline uint64_t* Data() const
+	{
+		return m_arr;
+	}
+
+	// number of bits set to true, words are split between threadsCnt threads
+	uint64_t CountTrue(uint64_t threadsCnt = 1) const
+	{
+		uint64_t wordsCnt = WordsCount();
+		threadsCnt = std::max<uint64_t>(1, std::min(threadsCnt, wordsCnt / (1ull << 16))); // thread is not worth it for less than 64K words
+		std::vector<uint64_t> counts(threadsCnt, 0);
+		auto countPart = [&](uint64_t part)
+		{
+			uint64_t cnt = 0;
+			for (uint64_t i = wordsCnt * part / threadsCnt; i < wordsCnt * (part + 1) / threadsCnt; i++)
+				cnt += std::popcount(m_arr[i]);
+			counts[part] = cnt;
+		};
+
+		std::vector<std::thread> threads;
+		for (uint64_t part = 1; part < threadsCnt; part++)
+			threads.emplace_back(countPart, part);
+		countPart(0);
+		for (auto& t : threads)
+			t.join();
+
+		uint64_t cnt = 0;
+		for (uint64_t c : counts)
+			cnt += c;
+		return cnt;
+	}
+
+	// calls fn(bitIndex) for each bit set to false starting from bitIndex from, stops when fn returns false
+	template<typename Fn>
+	void ForEachFalse(uint64_t from, Fn fn) const
+	{
+		for (uint64_t i = from >> WORD_2POWER; i < WordsCount(); i++)
+		{
+			uint64_t word = ~m_arr[i];
+			if (i == from >> WORD_2POWER)
+				word &= ~0ull << (from & WORD_MASK);
+			for (; word; word &= word - 1)
+			{
+				uint64_t bitIndex = (i << WORD_2POWER) + std::countr_zero(word);
+				if (bitIndex >= m_bits || !fn(bitIndex)) return;
+			}
+		}
+	}
+
+	void Assign(const MyBitset& src)
+	{
+		Init(src.m_bits);
+		memcpy(m_arr, src.m_arr, WordsCount() * sizeof(uint64_t));
+	}
 };
 
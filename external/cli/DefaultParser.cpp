@@ -118,7 +118,8 @@ void CDefaultParser::UpdateOptionsWithArguments(COption *option)
 
     for (auto it = m_ExpectedOptionWithArguments.begin(); it != m_ExpectedOptionWithArguments.end(); ++it)
     {
-        if( ((*it)->GetShortName() == shortName || ( !((*it)->GetLongName().empty()) && (*it)->GetLongName() == longName ) ) /* && argsAvailable */ )
+        // options without short name are matched by long name only, empty short names of different options are equal
+        if( ((!shortName.empty() && (*it)->GetShortName() == shortName) || ( !((*it)->GetLongName().empty()) && (*it)->GetLongName() == longName ) ) /* && argsAvailable */ )
         {
             m_ExpectedOptionWithArguments.erase(it);
             break;
@@ -133,7 +134,7 @@ void CDefaultParser::UpdateRequiredOptions(COption *option)
 
     for (auto it = m_ExpectedOption.begin(); it != m_ExpectedOption.end(); ++it)
     {
-        if ((*it)->GetShortName() == shortName || ( !((*it)->GetLongName().empty()) && (*it)->GetLongName() == longName ) )
+        if ((!shortName.empty() && (*it)->GetShortName() == shortName) || ( !((*it)->GetLongName().empty()) && (*it)->GetLongName() == longName ) )
         {
             m_ExpectedOption.erase(it);
             break;
@@ -3,7 +3,23 @@
 #include <string>
 #include <chrono>
 #include <iostream>
-#include "CommonFunctions.h"
+#include <fstream>
+#include <format>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "string_utils.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TICKS_HAS_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS_HAS_TSC
+#endif
 
 std::string millisecToStr(long long ms);
 
@@ -34,18 +50,226 @@ public:
 	}
 	static void PrintCon(long factor)
 	{
+#if defined(UNICODE) || defined(_UNICODE)
+		std::wostream& con = std::wcout;
+#else
+		std::ostream& con = std::cout;
+#endif
 		for (auto& item : f)
 		{
-			std::wcout << item.first << _T("=") << std::chrono::duration_cast<std::chrono::milliseconds>(item.second - s.at(item.first)).count() / factor << std::endl;
+			con << item.first << U("=") << std::chrono::duration_cast<std::chrono::milliseconds>(item.second - s.at(item.first)).count() / factor << std::endl;
 		}
 	}
 	static void Print(std::basic_iostream<char_t>& stream, long factor)
 	{
 		for (auto& item : f)
 		{
-			stream << item.first << _T("=") << std::chrono::duration_cast<std::chrono::milliseconds>(item.second - s.at(item.first)).count() / factor << std::endl;
+			stream << item.first << U("=") << std::chrono::duration_cast<std::chrono::milliseconds>(item.second - s.at(item.first)).count() / factor << std::endl;
+		}
+	}
+
+};
+
+// Low-overhead scoped profiler. Unlike Ticks it is thread-safe and does not allocate in measured code.
+// Usage: PROFILE_ZONE("name"); at the beginning of a block, zone is measured till the end of the block.
+// Zone name must be a string literal (profiler keeps the pointer).
+// Each thread writes its zones into its own buffer, so there are no locks in measured code:
+//   - ring buffer of last RING_SIZE events, used for Chrome trace export (chrome://tracing, ui.perfetto.dev)
+//   - aggregated statistics of each zone (count, total, min, max), nothing is lost when ring is overwritten
+// Timestamps are TSC ticks on x86 (steady_clock nanoseconds elsewhere), converted into nanoseconds on report.
+// Report() and ExportChromeTrace() must be called after measured threads are finished.
+// When profiler is disabled a zone costs one relaxed atomic load.
+class Profiler
+{
+public:
+	static const size_t RING_SIZE = 1 << 16; // events per thread
+	static const size_t MAX_ZONES = 64;      // different zone names per thread
+
+	struct Event
+	{
+		const char* name;
+		uint64_t start;
+		uint64_t finish;
+	};
+
+	struct Stat
+	{
+		const char* name = nullptr;
+		uint64_t count = 0;
+		uint64_t total = 0;
+		uint64_t min = UINT64_MAX;
+		uint64_t max = 0;
+
+		void Add(uint64_t ticks)
+		{
+			count++;
+			total += ticks;
+			min = std::min(min, ticks);
+			max = std::max(max, ticks);
+		}
+	};
+
+	// written by owner thread only
+	struct ThreadBuffer
+	{
+		uint32_t tid = 0;
+		std::atomic<uint64_t> written = 0; // total number of events written into ring
+		std::unique_ptr<Event[]> ring{ new Event[RING_SIZE] };
+		Stat stats[MAX_ZONES];
+		size_t statsCnt = 0;
+	};
+
+private:
+	static inline std::atomic<bool> s_enabled = false;
+	static inline std::mutex s_mutex; // protects list of buffers only
+	static inline std::vector<std::shared_ptr<ThreadBuffer>> s_buffers; // buffers live after their threads are finished
+	static inline uint64_t s_tick0 = 0; // calibration point of ticks and steady_clock, set by Enable()
+	static inline std::chrono::steady_clock::time_point s_time0;
+
+	static ThreadBuffer& local()
+	{
+		thread_local ThreadBuffer* buf = nullptr;
+		if (!buf)
+		{
+			auto b = std::make_shared<ThreadBuffer>();
+			std::lock_guard<std::mutex> lock(s_mutex);
+			b->tid = (uint32_t)s_buffers.size() + 1;
+			s_buffers.push_back(b);
+			buf = b.get();
+		}
+		return *buf;
+	}
+
+	static double nsPerTick()
+	{
+#ifdef TICKS_HAS_TSC
+		uint64_t ticks = Now() - s_tick0;
+		double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_time0).count();
+		return ticks > 0 ? ns / ticks : 1.0;
+#else
+		return 1.0;
+#endif
+	}
+
+public:
+	static uint64_t Now()
+	{
+#ifdef TICKS_HAS_TSC
+		return __rdtsc();
+#else
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	static void Enable(bool enable)
+	{
+		if (enable && !s_enabled)
+		{
+			s_time0 = std::chrono::steady_clock::now();
+			s_tick0 = Now();
+		}
+		s_enabled.store(enable, std::memory_order_relaxed);
+	}
+
+	static bool Enabled()
+	{
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+
+	static void Record(const char* name, uint64_t start, uint64_t finish)
+	{
+		ThreadBuffer& b = local();
+		uint64_t w = b.written.load(std::memory_order_relaxed);
+		b.ring[w % RING_SIZE] = Event{ name, start, finish };
+		b.written.store(w + 1, std::memory_order_release);
+
+		size_t i = 0;
+		while (i < b.statsCnt && b.stats[i].name != name) i++;
+		if (i == b.statsCnt)
+		{
+			if (b.statsCnt == MAX_ZONES) return; // too many zones, statistics of new ones are not collected
+			b.stats[b.statsCnt++].name = name;
+		}
+		b.stats[i].Add(finish - start);
+	}
+
+	// prints statistics of zones aggregated over all threads
+	static void Report(std::ostream& out)
+	{
+		double k = nsPerTick();
+		std::map<std::string, Stat> all; // zones with the same name in different threads are merged
+		{
+			std::lock_guard<std::mutex> lock(s_mutex);
+			for (auto& b : s_buffers)
+			{
+				for (size_t i = 0; i < b->statsCnt; i++)
+				{
+					Stat& s = all[b->stats[i].name];
+					s.count += b->stats[i].count;
+					s.total += b->stats[i].total;
+					s.min = std::min(s.min, b->stats[i].min);
+					s.max = std::max(s.max, b->stats[i].max);
+				}
+			}
 		}
+
+		out << std::format("{:<24} {:>10} {:>14} {:>12} {:>12} {:>12}", "Zone", "Count", "Total ms", "Avg us", "Min us", "Max us") << std::endl;
+		for (auto& [name, s] : all)
+			out << std::format("{:<24} {:>10} {:>14.3f} {:>12.3f} {:>12.3f} {:>12.3f}", name, s.count, s.total * k / 1e6, s.total * k / 1e3 / s.count, s.min * k / 1e3, s.max * k / 1e3) << std::endl;
+	}
+
+	// writes events from ring buffers in Chrome trace event format
+	static void ExportChromeTrace(const std::string& fileName)
+	{
+		std::ofstream f(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (f.fail())
+			throw std::invalid_argument("Error: cannot open file '" + fileName + "'\n");
+
+		double k = nsPerTick();
+		bool first = true;
+		f << "{\"traceEvents\":[\n";
+
+		std::lock_guard<std::mutex> lock(s_mutex);
+		for (auto& b : s_buffers)
+		{
+			uint64_t written = b->written.load(std::memory_order_acquire);
+			for (uint64_t i = written > RING_SIZE ? written - RING_SIZE : 0; i < written; i++)
+			{
+				const Event& e = b->ring[i % RING_SIZE];
+				f << (first ? "" : ",\n") << std::format("{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+					e.name, b->tid, (double)(int64_t)(e.start - s_tick0) * k / 1e3, (e.finish - e.start) * k / 1e3);
+				first = false;
+			}
+		}
+
+		f << "\n],\"displayTimeUnit\":\"ms\"}\n";
 	}
-	
 };
 
+// RAII zone of Profiler
+class ProfileZone
+{
+private:
+	const char* m_name;
+	uint64_t m_start = 0;
+	bool m_on;
+
+public:
+	ProfileZone(const char* name): m_name(name), m_on(Profiler::Enabled())
+	{
+		if (m_on) m_start = Profiler::Now();
+	}
+
+	~ProfileZone()
+	{
+		if (m_on) Profiler::Record(m_name, m_start, Profiler::Now());
+	}
+
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+
@@ -8,6 +8,9 @@
 #include "DefaultParser.h"
 #include "HelpFormatter.h"
 #include "ThreeN1.h"
+#include "ThreeN1Shards.h"
+#include "Bench.h"
+#include "BigIntBench.h"
 #include "string_utils.h"
 
 
@@ -20,6 +23,23 @@ static void PrintUsage(COptionsList& options)
 #define OPT_R _T("r")
 #define OPT_T _T("t")
 #define OPT_U _T("u")
+#define OPT_S _T("s")
+#define OPT_O _T("o")
+#define OPT_K _T("k")
+#define OPT_RESUME _T("resume")
+#define OPT_COORDINATOR _T("coordinator")
+#define OPT_WORKER _T("worker")
+#define OPT_BENCH _T("bench")
+#define OPT_PERF _T("perf")
+#define OPT_METRICS_OUT _T("metrics-out")
+#define OPT_TRACE_OUT _T("trace-out")
+#define OPT_BENCH_BIGINT _T("bench-bigint")
+#define OPT_RECORDS_ONLY _T("records-only")
+#define OPT_STEPS_TABLE _T("steps-table")
+#define OPT_COLUMNS_OUT _T("columns-out")
+#define OPT_UNUSED_OUT _T("unused-out")
+#define OPT_HIST_OUT _T("hist-out")
+#define OPT_BENCH_SCALING _T("bench-scaling")
 #define OPT_H _T("h")
 
 static void DefineOptions(COptionsList& options)
@@ -29,17 +49,85 @@ static void DefineOptions(COptionsList& options)
 	options.AddOption(cc);
 
 	COption rr;
-	rr.ShortName(OPT_R).LongName(_T("range")).Descr(_T("Define range for calculations")).Required(true).NumArgs(2).RequiredArgs(2);
+	rr.ShortName(OPT_R).LongName(_T("range")).Descr(_T("Define range for calculations. Required in all modes except --worker")).Required(false).NumArgs(2).RequiredArgs(2);
 	options.AddOption(rr);
 
 	COption tt;
-	tt.ShortName(OPT_T).LongName(_T("threads")).Descr(_T("Calculate with specified number of threads")).Required(false).NumArgs(1).RequiredArgs(1);
+	tt.ShortName(OPT_T).LongName(_T("threads")).Descr(_T("Calculate with specified number of threads (1 or more), 'auto' - choose number of threads by throughput. Count of active threads can be changed during calculation by signals SIGUSR1 (+1) and SIGUSR2 (-1)")).Required(false).NumArgs(1).RequiredArgs(1);
 	options.AddOption(tt);
 
 	COption uu;
 	uu.ShortName(OPT_U).LongName(_T("unused")).Descr(_T("Track unused numbers during calculations. Define range of unusued numbers. Range always starts from 0.")).Required(false).NumArgs(1).RequiredArgs(1);
 	options.AddOption(uu);
 
+	COption ss;
+	ss.ShortName(OPT_S).LongName(_T("subrange")).Descr(_T("Size of sub-range calculated by one thread at a time (10'000'000 by default). Used together with -t only.")).Required(false).NumArgs(1).RequiredArgs(1);
+	options.AddOption(ss);
+
+	COption oo;
+	oo.ShortName(OPT_O).LongName(_T("output")).Descr(_T("Save results of sub-ranges into specified file. Used together with -t only.")).Required(false).NumArgs(1).RequiredArgs(1);
+	options.AddOption(oo);
+
+	COption kk;
+	kk.ShortName(OPT_K).LongName(_T("checkpoint")).Descr(_T("Write checkpoints of threaded calculation into specified file. Optional second argument is interval between checkpoints in seconds (600 by default). Cannot be used together with --worker.")).Required(false).NumArgs(2).RequiredArgs(1);
+	options.AddOption(kk);
+
+	COption resume;
+	resume.LongName(OPT_RESUME).Descr(_T("Resume threaded calculation from checkpoint file specified by -k. Sub-ranges completed before are skipped.")).Required(false).NumArgs(0);
+	options.AddOption(resume);
+
+	COption coord;
+	coord.LongName(OPT_COORDINATOR).Descr(_T("Split range into shards for worker processes in specified shared directory and merge their results. Optional arguments: shard size (1G by default) and lease timeout in seconds (300 by default).")).Required(false).NumArgs(3).RequiredArgs(1);
+	options.AddOption(coord);
+
+	COption worker;
+	worker.LongName(OPT_WORKER).Descr(_T("Calculate shards from specified shared directory created by coordinator. Optional argument: lease timeout in seconds (300 by default). Uses -t threads.")).Required(false).NumArgs(2).RequiredArgs(1);
+	options.AddOption(worker);
+
+	COption bench;
+	bench.LongName(OPT_BENCH).Descr(_T("Run benchmark of all kernels and compare it with specified baseline JSON file (created if missing). Optional second argument is size of ranges in percents (100 by default). Exit code 2 means regression.")).Required(false).NumArgs(2).RequiredArgs(0);
+	options.AddOption(bench);
+
+	COption perf;
+	perf.LongName(OPT_PERF).Descr(_T("Print hardware counters (IPC, branch misses, cache misses) per sub-range and per kernel. Requires build with USE_PERF_COUNTERS on Linux.")).Required(false).NumArgs(0);
+	options.AddOption(perf);
+
+	COption metrics;
+	metrics.LongName(OPT_METRICS_OUT).Descr(_T("Write progress (each second) and new records as JSON lines into specified file.")).Required(false).NumArgs(1).RequiredArgs(1);
+	options.AddOption(metrics);
+
+	COption trace;
+	trace.LongName(OPT_TRACE_OUT).Descr(_T("Profile cache load, range compute, record reduction and file save. Print statistics of zones at the end and write timeline into specified file in Chrome trace format.")).Required(false).NumArgs(1).RequiredArgs(1);
+	options.AddOption(trace);
+
+	COption benchBigInt;
+	benchBigInt.LongName(OPT_BENCH_BIGINT).Descr(_T("Run micro-benchmark of BigInt operations (ns/op, allocations/op if built with USE_ALLOC_COUNTER). Optional argument is max size of operands in digits (10000 by default).")).Required(false).NumArgs(1).RequiredArgs(0);
+	options.AddOption(benchBigInt);
+
+	COption recordsOnly;
+	recordsOnly.LongName(OPT_RECORDS_ONLY).Descr(_T("Fast scan for records of steps and max value only: no total steps, no unused numbers, progress is counted per block of numbers, results of each sub-range hold only numbers that beat records known when the sub-range was started. Cannot be used together with -c and -u.")).Required(false).NumArgs(0);
+	options.AddOption(recordsOnly);
+
+	COption stepsTable;
+	stepsTable.LongName(OPT_STEPS_TABLE).Descr(_T("Search records of steps only and stop each trajectory as soon as it falls into table of steps of small numbers. Optional argument is size of the table (1M numbers, 2 MB by default). Used together with --records-only only, cannot be used together with -o, --coordinator or --worker.")).Required(false).NumArgs(1).RequiredArgs(0);
+	options.AddOption(stepsTable);
+
+	COption columnsOut;
+	columnsOut.LongName(OPT_COLUMNS_OUT).Descr(_T("Export steps and max value of every number into specified file (compressed columns in blocks with index, see ColumnarExport.h). Used together with -t only, cannot be used together with --records-only, --coordinator, --worker or --resume.")).Required(false).NumArgs(1).RequiredArgs(1);
+	options.AddOption(columnsOut);
+
+	COption unusedOut;
+	unusedOut.LongName(OPT_UNUSED_OUT).Descr(_T("Export all unused numbers into specified file (varint-encoded differences between numbers, see ThreeN1::unusedReport). Used together with -u only, cannot be used together with -t.")).Required(false).NumArgs(1).RequiredArgs(1);
+	options.AddOption(unusedOut);
+
+	COption histOut;
+	histOut.LongName(OPT_HIST_OUT).Descr(_T("Save histograms of steps and of log2(max value) into specified file. In threaded mode they are saved next to -o file by default.")).Required(false).NumArgs(1).RequiredArgs(1);
+	options.AddOption(histOut);
+
+	COption benchScaling;
+	benchScaling.LongName(OPT_BENCH_SCALING).Descr(_T("Run threaded calculation of the same range by 1, 2, 4, ... threads and print speedup against one thread. Optional arguments: max threads (number of hardware threads by default) and size of ranges in percents (100 by default).")).Required(false).NumArgs(2).RequiredArgs(0);
+	options.AddOption(benchScaling);
+
 	options.AddOption(OPT_H, _T("help"), _T("Show help"), 0);
 }
 
@@ -65,8 +153,85 @@ int _tmain(int argc, TCHAR* argv[])
 		return 0;
 	}
 
+	if (cmd.HasOption(OPT_BENCH))
+	{
+		uint64_t scale = Bench::SCALE_DEF;
+		try
+		{
+			scale = std::stoull(cmd.GetOptionValue(OPT_BENCH, 1, "def"));
+		}
+		catch (...)
+		{
+			// nothing to do, scale remains default in case of exception
+		}
+
+		try
+		{
+			Bench bench(scale);
+			return bench.Run(cmd.GetOptionValue(OPT_BENCH, 0, ""));
+		}
+		catch (std::exception& ex)
+		{
+			std::cout << ex.what() << std::endl;
+			return 1;
+		}
+	}
+
+	if (cmd.HasOption(OPT_BENCH_BIGINT))
+	{
+		uint64_t maxDigits = BigIntBench::MAX_DIGITS_DEF;
+		try
+		{
+			maxDigits = std::stoull(cmd.GetOptionValue(OPT_BENCH_BIGINT, 0, "def"));
+		}
+		catch (...)
+		{
+			// nothing to do, maxDigits remains default in case of exception
+		}
+
+		BigIntBench bench(maxDigits);
+		bench.Run();
+		return 0;
+	}
+
+	if (cmd.HasOption(OPT_BENCH_SCALING))
+	{
+		uint64_t maxThreads = 0, scale = Bench::SCALE_DEF;
+		try
+		{
+			maxThreads = std::stoull(cmd.GetOptionValue(OPT_BENCH_SCALING, 0, "def"));
+			scale = std::stoull(cmd.GetOptionValue(OPT_BENCH_SCALING, 1, "def"));
+		}
+		catch (...)
+		{
+			// nothing to do, values that are not specified remain default
+		}
+
+		try
+		{
+			Bench bench(scale);
+			bench.RunScaling(maxThreads);
+			return 0;
+		}
+		catch (std::exception& ex)
+		{
+			std::cout << ex.what() << std::endl;
+			return 1;
+		}
+	}
+
+	if (!cmd.HasOption(OPT_R) && !cmd.HasOption(OPT_WORKER))
+	{
+		std::cout << "Required option is missing: -r" << std::endl;
+		PrintUsage(options);
+		return 1;
+	}
+
 	std::cout << "START - Collatz conjecture solver (3n+1)" << std::endl;
 
+	if (cmd.HasOption(OPT_TRACE_OUT))
+		Profiler::Enable(true);
+
 	std::cout.imbue(std::locale(std::cout.getloc(), new MyGroupSeparator()));
 
 	auto start1 = std::chrono::high_resolution_clock::now();
@@ -95,9 +260,7 @@ int _tmain(int argc, TCHAR* argv[])
 
 			if (start > finish)
 			{
-				IntImpl tmp = start;
-				start = finish;
-				finish = tmp;
+				std::swap(start, finish);
 			}
 		}
 
@@ -120,22 +283,171 @@ int _tmain(int argc, TCHAR* argv[])
 			std::cout << "Track unused is ON. Range: 1.." << unusedRange << std::endl;
 		}
 		
-		if (cmd.HasOption(OPT_T))
+		if (cmd.HasOption(OPT_RECORDS_ONLY))
+		{
+			if (cmd.HasOption(OPT_C) || cmd.HasOption(OPT_U))
+				throw std::invalid_argument("Error: option --records-only cannot be used together with -c or -u.\n");
+			calc1.SetRecordsOnly(true);
+			std::cout << "Record-only scan is ON." << std::endl;
+
+			if (cmd.HasOption(OPT_STEPS_TABLE))
+			{
+				// max value of sub-ranges is not calculated, so files with results of sub-ranges cannot be written
+				if (cmd.HasOption(OPT_O) || cmd.HasOption(OPT_COORDINATOR) || cmd.HasOption(OPT_WORKER))
+					throw std::invalid_argument("Error: option --steps-table cannot be used together with -o, --coordinator or --worker: results of sub-ranges need max values.\n");
+
+				uint64_t size = StepsTable::SIZE_DEF;
+				try
+				{
+					size = ParseNumber(cmd.GetOptionValue(OPT_STEPS_TABLE, 0, "def"));
+				}
+				catch (...)
+				{
+					// nothing to do, size remains default in case of exception
+				}
+
+				calc1.SetStepsTable(size);
+				std::cout << "Steps table: " << size << " numbers, only records of steps are searched." << std::endl;
+			}
+		}
+		else if (cmd.HasOption(OPT_STEPS_TABLE))
+		{
+			throw std::invalid_argument("Error: option --steps-table requires --records-only.\n");
+		}
+
+		if (cmd.HasOption(OPT_UNUSED_OUT))
+		{
+			if (!cmd.HasOption(OPT_U) || cmd.HasOption(OPT_T) || cmd.HasOption(OPT_COORDINATOR) || cmd.HasOption(OPT_WORKER))
+				throw std::invalid_argument("Error: option --unused-out requires -u and cannot be used together with -t, --coordinator or --worker.\n");
+			calc1.SetUnusedOut(cmd.GetOptionValue(OPT_UNUSED_OUT, 0, "def"));
+			std::cout << "Unused numbers are exported into: " << cmd.GetOptionValue(OPT_UNUSED_OUT, 0, "def") << std::endl;
+		}
+
+		if (cmd.HasOption(OPT_HIST_OUT))
+			calc1.SetHistOut(cmd.GetOptionValue(OPT_HIST_OUT, 0, "def"));
+
+		if (cmd.HasOption(OPT_COLUMNS_OUT))
+		{
+			// export file is written from scratch, so blocks of sub-ranges completed before resume would be lost
+			if (!cmd.HasOption(OPT_T) || cmd.HasOption(OPT_RECORDS_ONLY) || cmd.HasOption(OPT_COORDINATOR) || cmd.HasOption(OPT_WORKER) || cmd.HasOption(OPT_RESUME))
+				throw std::invalid_argument("Error: option --columns-out requires -t and cannot be used together with --records-only, --coordinator, --worker or --resume.\n");
+			calc1.SetColumnsOut(cmd.GetOptionValue(OPT_COLUMNS_OUT, 0, "def"));
+			std::cout << "Steps and max values of all numbers are exported into: " << cmd.GetOptionValue(OPT_COLUMNS_OUT, 0, "def") << std::endl;
+		}
+
+		if (cmd.HasOption(OPT_PERF))
+		{
+			if (calc1.EnablePerfCounters(true))
+				std::cout << "Hardware counters are ON." << std::endl;
+			else
+				std::cout << "Hardware counters are not available (build without USE_PERF_COUNTERS or no access to perf_event_open)." << std::endl;
+		}
+
+		if (cmd.HasOption(OPT_METRICS_OUT))
+		{
+			calc1.SetMetricsOut(cmd.GetOptionValue(OPT_METRICS_OUT, 0, "def"));
+			std::cout << "Metrics are written into: " << cmd.GetOptionValue(OPT_METRICS_OUT, 0, "def") << std::endl;
+		}
+
+		if (cmd.HasOption(OPT_COORDINATOR))
+		{
+			std::string dir = cmd.GetOptionValue(OPT_COORDINATOR, 0, "def");
+			uint64_t shardSize = ThreeN1Shards<IntImpl>::SHARD_SIZE_DEF;
+			uint64_t leaseTimeout = ThreeN1Shards<IntImpl>::LEASE_TIMEOUT_DEF;
+			try
+			{
+				shardSize = ParseNumber(cmd.GetOptionValue(OPT_COORDINATOR, 1, "def"));
+				leaseTimeout = std::stoull(cmd.GetOptionValue(OPT_COORDINATOR, 2, "def"));
+			}
+			catch (...)
+			{
+				// nothing to do, values remain default in case of exception
+			}
+
+			if (cmd.HasOption(OPT_O))
+				calc1.SaveResultsTo(cmd.GetOptionValue(OPT_O, 0, "def"));
+
+			std::cout << "Coordinator mode. Shards directory: " << dir << " shard size: " << shardSize << " lease timeout: " << leaseTimeout << " sec" << std::endl;
+			ThreeN1Shards<IntImpl> shards(calc1, dir);
+			shards.Coordinate(start, finish, shardSize, leaseTimeout);
+		}
+		else if (cmd.HasOption(OPT_T) || cmd.HasOption(OPT_WORKER))
 		{
 			//Calculations in threads do NOT use CACHE at the moment
 			uint64_t threads = THREADS_DEF;
+			std::string value;
 			try
 			{
-				threads = std::stoull(cmd.GetOptionValue(OPT_T, 0, "def"));
+				value = cmd.GetOptionValue(OPT_T, 0, "def");
+				threads = value == "auto" ? decltype(calc1)::THREADS_AUTO : std::stoull(value);
 			}
 			catch (...)
 			{
 				// nothing to do, unused remains unchanged in case of exception
 			}
+			if (threads == decltype(calc1)::THREADS_AUTO && value != "auto") // 0 is reserved for auto mode internally
+				throw std::invalid_argument("Error: number of threads must be positive, use '-t auto' to choose it by throughput.\n");
 
-			std::cout << "Calculation is done in threads (" << threads << ")" << std::endl;
+			if (threads == decltype(calc1)::THREADS_AUTO)
+				std::cout << "Calculation is done in threads (auto)" << std::endl;
+			else
+				std::cout << "Calculation is done in threads (" << threads << ")" << std::endl;
 
-			if (cmd.HasOption(OPT_C))
+			if (cmd.HasOption(OPT_S))
+			{
+				calc1.SetTaskRange(ParseNumber(cmd.GetOptionValue(OPT_S, 0, "def")));
+				std::cout << "Sub-range size: " << calc1.m_taskRange << std::endl;
+			}
+
+			if (cmd.HasOption(OPT_O))
+			{
+				calc1.SaveResultsTo(cmd.GetOptionValue(OPT_O, 0, "def"));
+				std::cout << "Results of sub-ranges are saved into: " << cmd.GetOptionValue(OPT_O, 0, "def") << std::endl;
+			}
+
+			if (cmd.HasOption(OPT_K))
+			{
+				// worker calculates many shards with one checkpoint file, shard of crashed worker is recalculated after lease timeout instead
+				if (cmd.HasOption(OPT_WORKER))
+					throw std::invalid_argument("Error: options -k and --resume cannot be used together with --worker.\n");
+
+				std::string chkFile = cmd.GetOptionValue(OPT_K, 0, "def");
+				uint64_t interval = decltype(calc1)::CHECKPOINT_INTERVAL_DEF;
+				try
+				{
+					interval = std::stoull(cmd.GetOptionValue(OPT_K, 1, "def"));
+				}
+				catch (...)
+				{
+					// nothing to do, interval remains default in case of exception
+				}
+
+				calc1.SetCheckpoint(chkFile, interval, cmd.HasOption(OPT_RESUME));
+				std::cout << "Checkpoints are written into: " << chkFile << " (each " << interval << " seconds)" << std::endl;
+			}
+			else if (cmd.HasOption(OPT_RESUME))
+			{
+				throw std::invalid_argument("Error: option --resume requires checkpoint file specified by -k.\n");
+			}
+
+			if (cmd.HasOption(OPT_WORKER))
+			{
+				std::string dir = cmd.GetOptionValue(OPT_WORKER, 0, "def");
+				uint64_t leaseTimeout = ThreeN1Shards<IntImpl>::LEASE_TIMEOUT_DEF;
+				try
+				{
+					leaseTimeout = std::stoull(cmd.GetOptionValue(OPT_WORKER, 1, "def"));
+				}
+				catch (...)
+				{
+					// nothing to do, leaseTimeout remains default in case of exception
+				}
+
+				std::cout << "Worker mode. Shards directory: " << dir << std::endl;
+				ThreeN1Shards<IntImpl> shards(calc1, dir);
+				shards.Work(threads, leaseTimeout);
+			}
+			else if (cmd.HasOption(OPT_C))
 			{
 				//NOTE!!! Calculations in threads do NOT use CACHE at the moment
 				std::cout << "Using CACHE for claculations." << std::endl;
@@ -160,12 +472,17 @@ int _tmain(int argc, TCHAR* argv[])
 					calc1.CacheFromFileVarLen2("3-1G.binvar", toULongLong(finish));
 
 				auto stop = std::chrono::high_resolution_clock::now();
-				std::cout << "Loaded cache count:" << calc1.m_valuesCache.Count() << std::endl;
+				std::cout << "Loaded cache count:" << calc1.m_valuesCache.Count() << " (" << HugePages::KindStr(calc1.m_valuesCache.PagesKind()) << ")" << std::endl;
 				std::cout << "Loading cache time:" << MillisecToStr(std::chrono::duration_cast<std::chrono::milliseconds>(stop - startFS).count()) << std::endl;
 				
 				std::cout << "Using CACHE for claculations." << std::endl << std::endl;
 				calc1.Calc3p1RangeCache(start, finish);
 			}
+			else if (cmd.HasOption(OPT_RECORDS_ONLY))
+			{
+				std::cout << "Calculating records only." << std::endl << std::endl;
+				calc1.Calc3p1RangeFast(start, finish);
+			}
 			else // here goes option -r which is mandatory
 			{
 				std::cout << "Calculating WITHOUT cache." << std::endl << std::endl;
@@ -205,6 +522,21 @@ int _tmain(int argc, TCHAR* argv[])
 	}
 
 
+	if (cmd.HasOption(OPT_TRACE_OUT))
+	{
+		Profiler::Enable(false);
+		Profiler::Report(std::cout);
+		try
+		{
+			Profiler::ExportChromeTrace(cmd.GetOptionValue(OPT_TRACE_OUT, 0, "def"));
+			std::cout << "Trace is written into: " << cmd.GetOptionValue(OPT_TRACE_OUT, 0, "def") << std::endl;
+		}
+		catch (std::exception& ex)
+		{
+			std::cout << ex.what() << std::endl;
+		}
+	}
+
 	auto stop = std::chrono::high_resolution_clock::now();
 	std::cout << "Time spent:" << MillisecToStr(std::chrono::duration_cast<std::chrono::milliseconds>(stop - start1).count()) << std::endl;
 	std::cout << "Time spent for file saving:" << MillisecToStr(std::chrono::duration_cast<std::chrono::milliseconds>(stop - startFS).count()) << std::endl;